@@ -0,0 +1,168 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+// Fixed timestep animation. The simulation advances in whole ticks of
+// AnimationClock::step seconds however long a frame took, and rendering
+// blends the last two ticks by animationAlpha(), so frame rate never changes
+// animation speed. Tracks are scalar tweens kept in structure of arrays
+// storage and stepped together in one pass; a position is three tracks.
+
+#define ANIMATION_MAX_TICKS     8       // per frame, longer stalls drop time
+
+#define TRACK_EASE_LINEAR       0
+#define TRACK_EASE_IN_OUT       1
+#define TRACK_EASE_OUT          2
+
+#define TRACK_ONCE              0       // holds the end value
+#define TRACK_REPEAT            1       // keeps going, from + n * (to - from)
+#define TRACK_PING_PONG         2       // from, to, from, ...
+
+typedef struct _animationClock
+{
+    double step;            // seconds per tick
+    double time;            // simulation time, a whole number of ticks
+    double accumulator;     // real time not simulated yet
+} AnimationClock;
+
+typedef struct _animationTracks
+{
+    std::vector<float> from;
+    std::vector<float> to;
+    std::vector<double> starts;         // simulation time, seconds
+    std::vector<float> durations;
+    std::vector<uint8_t> eases;
+    std::vector<uint8_t> repeats;
+    std::vector<float> previous;        // value at the tick before last
+    std::vector<float> current;         // value at the last tick
+} AnimationTracks;
+
+void initAnimationClock(AnimationClock *clock, double ticksPerSecond)
+{
+    clock->step = 1.0 / ticksPerSecond;
+    clock->time = 0.0;
+    clock->accumulator = 0.0;
+}
+
+// Banks a frame's real time, returns how many ticks to simulate now
+int advanceAnimationClock(AnimationClock *clock, double elapsed)
+{
+    clock->accumulator += elapsed;
+
+    int ticks = (int) (clock->accumulator / clock->step);
+    if (ticks > ANIMATION_MAX_TICKS) {
+        // catching up after a stall would only stall the next frame too
+        ticks = ANIMATION_MAX_TICKS;
+        clock->accumulator = ticks * clock->step;
+    }
+    clock->accumulator -= ticks * clock->step;
+
+    return ticks;
+}
+
+// Advances simulation time by one tick and returns it
+double nextAnimationTick(AnimationClock *clock)
+{
+    clock->time += clock->step;
+    return clock->time;
+}
+
+// How far rendering is between the last tick and the next one, 0..1
+float animationAlpha(const AnimationClock *clock)
+{
+    return (float) (clock->accumulator / clock->step);
+}
+
+int trackCount(const AnimationTracks *tracks)
+{
+    return (int) tracks->current.size();
+}
+
+int addTrack(AnimationTracks *tracks, float from, float to, double start, float duration,
+             uint8_t ease, uint8_t repeat)
+{
+    tracks->from.push_back(from);
+    tracks->to.push_back(to);
+    tracks->starts.push_back(start);
+    tracks->durations.push_back(duration);
+    tracks->eases.push_back(ease);
+    tracks->repeats.push_back(repeat);
+    tracks->previous.push_back(from);
+    tracks->current.push_back(from);
+
+    return trackCount(tracks) - 1;
+}
+
+// Tweens from wherever the track is now, so a moving track changes course
+// without jumping
+void retargetTrack(AnimationTracks *tracks, int index, float to, double start, float duration)
+{
+    tracks->from[index] = tracks->current[index];
+    tracks->to[index] = to;
+    tracks->starts[index] = start;
+    tracks->durations[index] = duration;
+}
+
+float easeTrack(uint8_t ease, float t)
+{
+    switch (ease) {
+    case TRACK_EASE_IN_OUT:
+        return t * t * (3.0f - 2.0f * t);
+    case TRACK_EASE_OUT:
+        return 1.0f - (1.0f - t) * (1.0f - t);
+    default:
+        return t;
+    }
+}
+
+// Evaluates every track at simulation time, one pass over flat arrays
+void stepTracks(AnimationTracks *tracks, double time)
+{
+    int count = trackCount(tracks);
+
+    tracks->previous = tracks->current;
+    for (int i = 0; i < count; i++) {
+        float t = 1.0f;
+        if (tracks->durations[i] > 0.0f)
+            t = (float) ((time - tracks->starts[i]) / tracks->durations[i]);
+        if (t < 0.0f)
+            t = 0.0f;
+
+        float cycles = 0.0f;
+        if (tracks->repeats[i] == TRACK_ONCE) {
+            if (t > 1.0f)
+                t = 1.0f;
+        } else {
+            cycles = floorf(t);
+            t -= cycles;
+            if (tracks->repeats[i] == TRACK_PING_PONG) {
+                if (fmodf(cycles, 2.0f) != 0.0f)
+                    t = 1.0f - t;
+                cycles = 0.0f;
+            }
+        }
+
+        float from = tracks->from[i];
+        tracks->current[i] = from + (tracks->to[i] - from) * (cycles + easeTrack(tracks->eases[i], t));
+    }
+}
+
+// Value at render time, alpha from animationAlpha()
+float sampleTrack(const AnimationTracks *tracks, int index, float alpha)
+{
+    float previous = tracks->previous[index];
+    return previous + (tracks->current[index] - previous) * alpha;
+}
+
+void sampleTracks(const AnimationTracks *tracks, float alpha, float *values)
+{
+    int count = trackCount(tracks);
+
+    for (int i = 0; i < count; i++)
+        values[i] = tracks->previous[i] + (tracks->current[i] - tracks->previous[i]) * alpha;
+}
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef BUFFER_GLES_H
+#define BUFFER_GLES_H
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <vertex_format.h>
+#include <vertex_array_gles.h>
+
+// Largest vertex count a GL_UNSIGNED_SHORT index can address
+#define MESH_MAX_CHUNK_VERTICES 65536
+
+// Owns every GL buffer object a sample creates, so geometry is uploaded once
+// and freed in one place.
+typedef struct _bufferManager
+{
+    std::vector<GLuint> buffers;
+    GLsizeiptr bytesUploaded = 0;
+} BufferManager;
+
+typedef struct _meshAttrib
+{
+    GLint location;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei offset;
+} MeshAttrib;
+
+// Range of a mesh drawable with 16-bit (or 8-bit) indices. GLES2 has no base
+// vertex, so each chunk's attribute pointers start at its vertexOffset.
+typedef struct _meshChunk
+{
+    GLintptr vertexOffset;
+    GLintptr indexOffset;
+    GLsizei numIndices;
+} MeshChunk;
+
+// CPU side result of index type selection and chunking, ready for upload
+typedef struct _meshData
+{
+    std::vector<unsigned char> vertices;    // empty when the source needs no split
+    std::vector<unsigned char> indices;
+    std::vector<MeshChunk> chunks;
+    GLenum indexType;
+} MeshData;
+
+// Geometry living in a VBO/IBO pair, drawn with buffer offsets
+typedef struct _mesh
+{
+    GLuint vbo;
+    GLuint ibo;
+    GLsizei stride;
+    GLenum indexType;
+    std::vector<MeshChunk> chunks;
+    std::vector<MeshAttrib> attribs;
+    std::vector<VertexArray> arrays;    // one per chunk, see setMeshFormat
+} Mesh;
+
+// usage is GL_STATIC_DRAW for geometry uploaded once, GL_DYNAMIC_DRAW for
+// geometry rewritten now and then, GL_STREAM_DRAW for per-frame data
+GLuint createBuffer(BufferManager *manager, GLenum target, GLsizeiptr size,
+                    const void *data, GLenum usage)
+{
+    GLuint buffer;
+
+    glGenBuffers(1, &buffer);
+    if (target == GL_ELEMENT_ARRAY_BUFFER)
+        bindElementBuffer(buffer);
+    else
+        cacheBindBuffer(target, buffer);
+    glBufferData(target, size, data, usage);
+
+    manager->buffers.push_back(buffer);
+    if (data != NULL)
+        manager->bytesUploaded += size;
+
+    return buffer;
+}
+
+void updateBuffer(BufferManager *manager, GLenum target, GLuint buffer,
+                  GLintptr offset, GLsizeiptr size, const void *data)
+{
+    if (target == GL_ELEMENT_ARRAY_BUFFER)
+        bindElementBuffer(buffer);
+    else
+        cacheBindBuffer(target, buffer);
+    glBufferSubData(target, offset, size, data);
+    manager->bytesUploaded += size;
+}
+
+void destroyBuffers(BufferManager *manager)
+{
+    if (!manager->buffers.empty())
+        cacheDeleteBuffers(manager->buffers.size(), &manager->buffers[0]);
+    manager->buffers.clear();
+}
+
+// Smallest index type able to address numVertices
+GLenum indexTypeFor(int numVertices)
+{
+    if (numVertices <= 256)
+        return GL_UNSIGNED_BYTE;
+    if (numVertices <= MESH_MAX_CHUNK_VERTICES)
+        return GL_UNSIGNED_SHORT;
+
+    return GL_UNSIGNED_INT;
+}
+
+GLsizei indexTypeSize(GLenum type)
+{
+    switch (type) {
+    case GL_UNSIGNED_BYTE:
+        return 1;
+    case GL_UNSIGNED_SHORT:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+void appendIndex(std::vector<unsigned char> &out, GLenum type, GLuint index)
+{
+    if (type == GL_UNSIGNED_BYTE) {
+        out.push_back((GLubyte) index);
+    } else {
+        GLushort value = (GLushort) index;
+        const unsigned char *bytes = (const unsigned char *) &value;
+        out.insert(out.end(), bytes, bytes + sizeof(value));
+    }
+}
+
+// Picks GL_UNSIGNED_BYTE/SHORT indices and, for meshes over 64K vertices,
+// splits the triangle list into chunks that each reference at most 64K
+// vertices, duplicating the vertices shared across a chunk border.
+void buildMeshData(const void *vertices, int numVertices, GLsizei stride,
+                   const GLuint *indices, int numIndices, MeshData *data)
+{
+    data->vertices.clear();
+    data->indices.clear();
+    data->chunks.clear();
+
+    if (numVertices <= MESH_MAX_CHUNK_VERTICES) {
+        MeshChunk chunk = { 0, 0, numIndices };
+
+        data->indexType = indexTypeFor(numVertices);
+        data->indices.reserve(numIndices * indexTypeSize(data->indexType));
+        for (int i = 0; i < numIndices; i++)
+            appendIndex(data->indices, data->indexType, indices[i]);
+        data->chunks.push_back(chunk);
+        return;
+    }
+
+    const unsigned char *src = (const unsigned char *) vertices;
+    std::vector<GLint> remap(numVertices, -1);
+    std::vector<GLuint> used;
+    MeshChunk chunk = { 0, 0, 0 };
+
+    data->indexType = GL_UNSIGNED_SHORT;
+    for (int tri = 0; tri + 2 < numIndices; tri += 3) {
+        int added = 0;
+        for (int i = 0; i < 3; i++) {
+            if (remap[indices[tri + i]] < 0)
+                added++;
+        }
+
+        // close the chunk before this triangle would overflow it
+        if (used.size() + added > MESH_MAX_CHUNK_VERTICES) {
+            data->chunks.push_back(chunk);
+            for (GLuint index : used)
+                remap[index] = -1;
+            used.clear();
+
+            chunk.vertexOffset = data->vertices.size();
+            chunk.indexOffset = data->indices.size();
+            chunk.numIndices = 0;
+        }
+
+        for (int i = 0; i < 3; i++) {
+            GLuint index = indices[tri + i];
+            if (remap[index] < 0) {
+                remap[index] = used.size();
+                used.push_back(index);
+                data->vertices.insert(data->vertices.end(), src + index * stride,
+                                      src + (index + 1) * stride);
+            }
+            appendIndex(data->indices, data->indexType, remap[index]);
+        }
+        chunk.numIndices += 3;
+    }
+
+    if (chunk.numIndices > 0)
+        data->chunks.push_back(chunk);
+}
+
+Mesh createMesh(BufferManager *manager, const void *vertices, int numVertices,
+                GLsizei stride, const GLuint *indices, int numIndices, GLenum usage)
+{
+    Mesh mesh;
+    MeshData data;
+
+    buildMeshData(vertices, numVertices, stride, indices, numIndices, &data);
+
+    mesh.stride = stride;
+    mesh.indexType = data.indexType;
+    mesh.chunks = data.chunks;
+    mesh.vbo = mesh.ibo = 0;
+
+    // nothing to draw, no buffers either
+    if (numVertices == 0 || data.indices.empty()) {
+        mesh.chunks.clear();
+        return mesh;
+    }
+
+    if (data.vertices.empty())
+        mesh.vbo = createBuffer(manager, GL_ARRAY_BUFFER, numVertices * stride,
+                                vertices, usage);
+    else
+        mesh.vbo = createBuffer(manager, GL_ARRAY_BUFFER, data.vertices.size(),
+                                data.vertices.data(), usage);
+    mesh.ibo = createBuffer(manager, GL_ELEMENT_ARRAY_BUFFER, data.indices.size(),
+                            data.indices.data(), usage);
+
+    return mesh;
+}
+
+// Frees the vertex arrays, the buffers belong to the BufferManager
+void destroyMesh(Mesh *mesh)
+{
+    for (VertexArray &array : mesh->arrays)
+        destroyVertexArray(&array);
+    mesh->arrays.clear();
+}
+
+// Describes where an attribute lives inside a vertex, offset is in bytes
+void setMeshAttrib(Mesh *mesh, GLint location, GLint size, GLenum type,
+                   GLboolean normalized, GLsizei offset)
+{
+    MeshAttrib attrib = { location, size, type, normalized, offset };
+
+    if (location >= 0)
+        mesh->attribs.push_back(attrib);
+}
+
+// Records each chunk's attribute pointers and index buffer in a vertex array,
+// call again after changing the attributes
+void buildMeshArrays(Mesh *mesh)
+{
+    destroyMesh(mesh);
+
+    mesh->arrays.resize(mesh->chunks.size());
+    for (size_t i = 0; i < mesh->chunks.size(); i++) {
+        VertexArray *array = &mesh->arrays[i];
+
+        createVertexArray(array);
+        for (const MeshAttrib &attrib : mesh->attribs)
+            setVertexArrayAttrib(array, attrib.location, mesh->vbo, attrib.size, attrib.type,
+                                 attrib.normalized, mesh->stride,
+                                 mesh->chunks[i].vertexOffset + attrib.offset);
+        setVertexArrayElements(array, mesh->ibo);
+    }
+    bindVertexArray(NULL);
+}
+
+// Takes the stride and attribute layout from a resolved vertex format
+void setMeshFormat(Mesh *mesh, const VertexFormat *format)
+{
+    mesh->stride = format->stride;
+    mesh->attribs.clear();
+    for (int i = 0; i < format->numElements; i++) {
+        const VertexElement *element = &format->elements[i];
+        setMeshAttrib(mesh, element->location, element->size, element->type,
+                      element->normalized, element->offset);
+    }
+    buildMeshArrays(mesh);
+}
+
+// Quantizes float vertices (see encodeVertices) into format and uploads them
+Mesh createEncodedMesh(BufferManager *manager, const VertexFormat *format,
+                       const GLfloat *vertices, int numVertices,
+                       const GLuint *indices, int numIndices, GLenum usage)
+{
+    std::vector<unsigned char> encoded(numVertices * format->stride);
+
+    if (numVertices > 0)
+        encodeVertices(format, vertices, numVertices, encoded.data());
+    Mesh mesh = createMesh(manager, encoded.data(), numVertices, format->stride,
+                           indices, numIndices, usage);
+    setMeshFormat(&mesh, format);
+
+    return mesh;
+}
+
+void drawMesh(const Mesh *mesh)
+{
+    for (size_t i = 0; i < mesh->chunks.size(); i++) {
+        const MeshChunk &chunk = mesh->chunks[i];
+
+        bindVertexArray(&mesh->arrays[i]);
+        glDrawElements(GL_TRIANGLES, chunk.numIndices, mesh->indexType,
+                       (void *) chunk.indexOffset);
+    }
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef COMMAND_BUFFER_GLES_H
+#define COMMAND_BUFFER_GLES_H
+
+#include <GLES2/gl2.h>
+
+#include <stdint.h>
+#include <vector>
+
+#include <buffer_gles.h>
+#include <gl_state_gles.h>
+
+// GL work recorded now and issued later. Recording makes no GL calls, so
+// any thread can fill a buffer; replayCommandBuffer() must run on the thread
+// owning the context. Commands are fixed size records in a flat array and
+// replay is one switch per command. Buffers keep their capacity across
+// resets, so steady state recording doesn't allocate. Replay goes through
+// the GL state cache, so state repeated across buffers isn't reissued.
+
+#define COMMAND_USE_PROGRAM         0
+#define COMMAND_BIND_TEXTURE        1   // GL_TEXTURE_2D on the active unit
+#define COMMAND_UNIFORM_1F          2
+#define COMMAND_VERTEX_ATTRIB_4F    3
+#define COMMAND_ENABLE              4
+#define COMMAND_DISABLE             5
+#define COMMAND_BLEND_FUNC          6
+#define COMMAND_DEPTH_MASK          7
+#define COMMAND_DRAW_MESH           8
+
+typedef struct _command
+{
+    uint32_t op;
+    GLint arg;                  // program, texture, location or capability
+    union
+    {
+        GLfloat values[4];
+        GLenum factors[2];
+        const Mesh *mesh;       // must outlive the replay
+    } data;
+} Command;
+
+typedef struct _commandBuffer
+{
+    std::vector<Command> commands;
+} CommandBuffer;
+
+void resetCommandBuffer(CommandBuffer *buffer)
+{
+    buffer->commands.clear();
+}
+
+Command *recordCommand(CommandBuffer *buffer, uint32_t op, GLint arg)
+{
+    buffer->commands.resize(buffer->commands.size() + 1);
+
+    Command *command = &buffer->commands.back();
+    command->op = op;
+    command->arg = arg;
+    return command;
+}
+
+void recordUseProgram(CommandBuffer *buffer, GLuint program)
+{
+    recordCommand(buffer, COMMAND_USE_PROGRAM, program);
+}
+
+void recordBindTexture(CommandBuffer *buffer, GLuint texture)
+{
+    recordCommand(buffer, COMMAND_BIND_TEXTURE, texture);
+}
+
+void recordUniform1f(CommandBuffer *buffer, GLint location, GLfloat value)
+{
+    recordCommand(buffer, COMMAND_UNIFORM_1F, location)->data.values[0] = value;
+}
+
+void recordVertexAttrib4f(CommandBuffer *buffer, GLint location,
+                          GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+{
+    Command *command = recordCommand(buffer, COMMAND_VERTEX_ATTRIB_4F, location);
+    command->data.values[0] = x;
+    command->data.values[1] = y;
+    command->data.values[2] = z;
+    command->data.values[3] = w;
+}
+
+void recordEnable(CommandBuffer *buffer, GLenum capability, bool enable)
+{
+    recordCommand(buffer, enable ? COMMAND_ENABLE : COMMAND_DISABLE, capability);
+}
+
+void recordBlendFunc(CommandBuffer *buffer, GLenum source, GLenum destination)
+{
+    Command *command = recordCommand(buffer, COMMAND_BLEND_FUNC, 0);
+    command->data.factors[0] = source;
+    command->data.factors[1] = destination;
+}
+
+void recordDepthMask(CommandBuffer *buffer, GLboolean write)
+{
+    recordCommand(buffer, COMMAND_DEPTH_MASK, write);
+}
+
+void recordDrawMesh(CommandBuffer *buffer, const Mesh *mesh)
+{
+    recordCommand(buffer, COMMAND_DRAW_MESH, 0)->data.mesh = mesh;
+}
+
+void replayCommandBuffer(const CommandBuffer *buffer)
+{
+    const Command *command = buffer->commands.data();
+    const Command *end = command + buffer->commands.size();
+
+    for (; command != end; command++) {
+        switch (command->op) {
+        case COMMAND_USE_PROGRAM:
+            cacheUseProgram(command->arg);
+            break;
+        case COMMAND_BIND_TEXTURE:
+            cacheBindTexture(command->arg);
+            break;
+        case COMMAND_UNIFORM_1F:
+            glUniform1f(command->arg, command->data.values[0]);
+            break;
+        case COMMAND_VERTEX_ATTRIB_4F:
+            glVertexAttrib4fv(command->arg, command->data.values);
+            break;
+        case COMMAND_ENABLE:
+            cacheEnable(command->arg, true);
+            break;
+        case COMMAND_DISABLE:
+            cacheEnable(command->arg, false);
+            break;
+        case COMMAND_BLEND_FUNC:
+            cacheBlendFunc(command->data.factors[0], command->data.factors[1]);
+            break;
+        case COMMAND_DEPTH_MASK:
+            cacheDepthMask(command->arg);
+            break;
+        case COMMAND_DRAW_MESH:
+            drawMesh(command->data.mesh);
+            break;
+        }
+    }
+}
+
+#endif
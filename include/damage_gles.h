@@ -0,0 +1,309 @@
+#ifndef DAMAGE_GLES_H
+#define DAMAGE_GLES_H
+
+#include <GLES2/gl2.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gl_state_gles.h>
+#include <extension_gles.h>
+#include <headless_egl.h>
+
+// Partial redraw. Samples report the window rectangles that changed, the
+// frame is cleared and drawn under a scissor covering only them, and the
+// swap tells the compositor which part of the surface is new.
+//
+// A back buffer may be several frames old, so with EGL_EXT_buffer_age the
+// damage of the frames it missed is repainted too; without it the back
+// buffer contents are unknown and every frame repaints everything. The
+// headless backend draws to one buffer that is never swapped out, so there
+// every frame is one frame old.
+// EGL_KHR_partial_update announces the repainted region to the driver and
+// EGL_KHR/EXT_swap_buffers_with_damage presents only the changed one.
+// DAMAGE_TRACKING=0 repaints and presents whole frames.
+//
+// Damage is a short list of disjoint rectangles, so changes far apart don't
+// repaint what lies between them. Overlapping ones are merged as they come
+// in; past DAMAGE_MAX_RECTS the two whose union wastes the least are. The
+// frame is drawn once per repainted rectangle, under its scissor.
+//
+// Rectangles are in window pixels with the origin at the bottom left, like
+// glScissor, and empty when x0 >= x1 or y0 >= y1.
+
+#define DAMAGE_HISTORY      4   // oldest buffer age repainted partially is this + 1
+#define DAMAGE_MAX_RECTS    4
+
+typedef struct _damageRect
+{
+    GLint x0, y0;
+    GLint x1, y1;
+} DamageRect;
+
+typedef struct _damageRegion
+{
+    DamageRect rects[DAMAGE_MAX_RECTS];
+    int count;
+} DamageRegion;
+
+typedef struct _damageTracker
+{
+    EGLDisplay display;
+    EGLSurface surface;
+    GLint width;
+    GLint height;
+    bool enabled;
+    bool bufferAge;
+    bool retained;                          // the surface keeps its last frame
+    PFNEGLSETDAMAGEREGIONKHRPROC setDamageRegion;
+    PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swapBuffersWithDamage;
+
+    DamageRegion current;                   // changed this frame
+    DamageRegion history[DAMAGE_HISTORY];   // changed in earlier frames, [0] the last one
+    DamageRegion repaint;                   // drawn this frame
+    bool full;                              // repaint is the whole surface
+
+    long long pixelsRepainted;
+    long long pixelsPresented;
+    long long pixelsTotal;                  // what full frames would have cost
+} DamageTracker;
+
+bool damageEmpty(const DamageRect *rect)
+{
+    return rect->x0 >= rect->x1 || rect->y0 >= rect->y1;
+}
+
+GLint damageArea(const DamageRect *rect)
+{
+    return damageEmpty(rect) ? 0 : (rect->x1 - rect->x0) * (rect->y1 - rect->y0);
+}
+
+void unionDamage(DamageRect *rect, const DamageRect *other)
+{
+    if (damageEmpty(other))
+        return;
+    if (damageEmpty(rect)) {
+        *rect = *other;
+        return;
+    }
+
+    rect->x0 = rect->x0 < other->x0 ? rect->x0 : other->x0;
+    rect->y0 = rect->y0 < other->y0 ? rect->y0 : other->y0;
+    rect->x1 = rect->x1 > other->x1 ? rect->x1 : other->x1;
+    rect->y1 = rect->y1 > other->y1 ? rect->y1 : other->y1;
+}
+
+bool damageOverlaps(const DamageRect *a, const DamageRect *b)
+{
+    return a->x0 < b->x1 && b->x0 < a->x1 && a->y0 < b->y1 && b->y0 < a->y1;
+}
+
+GLint regionArea(const DamageRegion *region)
+{
+    GLint area = 0;
+
+    for (int i = 0; i < region->count; i++)
+        area += damageArea(&region->rects[i]);
+    return area;
+}
+
+void removeDamageRect(DamageRegion *region, int index)
+{
+    region->rects[index] = region->rects[--region->count];
+}
+
+// Keeps the rectangles disjoint and at most DAMAGE_MAX_RECTS
+void addDamageRect(DamageRegion *region, const DamageRect *rect)
+{
+    if (damageEmpty(rect))
+        return;
+
+    // a union may reach rectangles neither part touched, so start over
+    DamageRect added = *rect;
+    for (int i = 0; i < region->count;) {
+        if (damageOverlaps(&region->rects[i], &added)) {
+            unionDamage(&added, &region->rects[i]);
+            removeDamageRect(region, i);
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (region->count < DAMAGE_MAX_RECTS) {
+        region->rects[region->count++] = added;
+        return;
+    }
+
+    // full: merge the pair, the new one included, that adds the least area
+    int best = -1;
+    GLint bestWaste = 0;
+    for (int i = 0; i < region->count; i++) {
+        DamageRect merged = region->rects[i];
+        unionDamage(&merged, &added);
+        GLint waste = damageArea(&merged) - damageArea(&region->rects[i]) - damageArea(&added);
+        if (best < 0 || waste < bestWaste) {
+            best = i;
+            bestWaste = waste;
+        }
+    }
+    unionDamage(&added, &region->rects[best]);
+    removeDamageRect(region, best);
+    addDamageRect(region, &added);
+}
+
+void addDamageRegion(DamageRegion *region, const DamageRegion *other)
+{
+    for (int i = 0; i < other->count; i++)
+        addDamageRect(region, &other->rects[i]);
+}
+
+// x, y, width, height per rectangle, as EGL takes them
+void damageRegionToEGL(const DamageRegion *region, EGLint rects[4 * DAMAGE_MAX_RECTS])
+{
+    for (int i = 0; i < region->count; i++) {
+        const DamageRect *rect = &region->rects[i];
+        rects[i * 4 + 0] = rect->x0;
+        rects[i * 4 + 1] = rect->y0;
+        rects[i * 4 + 2] = rect->x1 - rect->x0;
+        rects[i * 4 + 3] = rect->y1 - rect->y0;
+    }
+}
+
+void initDamageTracker(DamageTracker *tracker, EGLDisplay display, EGLSurface surface,
+                       GLint width, GLint height)
+{
+    const char *tracking = getenv("DAMAGE_TRACKING");
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+
+    memset(tracker, 0, sizeof(DamageTracker));
+    tracker->display = display;
+    tracker->surface = surface;
+    tracker->width = width;
+    tracker->height = height;
+    tracker->enabled = tracking == NULL || atoi(tracking) != 0;
+    tracker->retained = headlessTarget.active;
+
+    tracker->bufferAge = extensionListHas(extensions, "EGL_EXT_buffer_age");
+    if (extensionListHas(extensions, "EGL_KHR_partial_update"))
+        tracker->setDamageRegion = (PFNEGLSETDAMAGEREGIONKHRPROC)
+            eglGetProcAddress("eglSetDamageRegionKHR");
+    if (extensionListHas(extensions, "EGL_KHR_swap_buffers_with_damage"))
+        tracker->swapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+            eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    else if (extensionListHas(extensions, "EGL_EXT_swap_buffers_with_damage"))
+        tracker->swapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+            eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+
+    // nothing on screen yet
+    DamageRect all = { 0, 0, width, height };
+    addDamageRect(&tracker->current, &all);
+}
+
+// Clipped to the surface; the bounds are in pixels and may be fractional
+void addDamage(DamageTracker *tracker, float x0, float y0, float x1, float y1)
+{
+    DamageRect rect = { (GLint) floorf(x0), (GLint) floorf(y0),
+                        (GLint) ceilf(x1), (GLint) ceilf(y1) };
+
+    rect.x0 = rect.x0 > 0 ? rect.x0 : 0;
+    rect.y0 = rect.y0 > 0 ? rect.y0 : 0;
+    rect.x1 = rect.x1 < tracker->width ? rect.x1 : tracker->width;
+    rect.y1 = rect.y1 < tracker->height ? rect.y1 : tracker->height;
+    addDamageRect(&tracker->current, &rect);
+}
+
+void damageAll(DamageTracker *tracker)
+{
+    addDamage(tracker, 0.0f, 0.0f, tracker->width, tracker->height);
+}
+
+// Works out what this frame repaints. Returns the number of rectangles to
+// draw the frame in, each after scissorDamage(); 0 when nothing changed and
+// the frame can be skipped along with its swap.
+int beginDamagedFrame(DamageTracker *tracker)
+{
+    DamageRect all = { 0, 0, tracker->width, tracker->height };
+    EGLint age = 0;
+
+    memset(&tracker->repaint, 0, sizeof(DamageRegion));
+    tracker->full = true;
+    if (!tracker->enabled) {
+        addDamageRect(&tracker->repaint, &all);
+        return 1;
+    }
+    if (tracker->current.count == 0)
+        return 0;
+
+    if (tracker->retained)
+        age = 1;
+    else if (!tracker->bufferAge ||
+             !eglQuerySurface(tracker->display, tracker->surface, EGL_BUFFER_AGE_EXT, &age))
+        age = 0;
+
+    // age 0 is unknown contents, age n missed the changes of n - 1 frames
+    if (age == 0 || age > DAMAGE_HISTORY + 1) {
+        addDamageRect(&tracker->repaint, &all);
+    } else {
+        tracker->repaint = tracker->current;
+        for (int i = 0; i < age - 1; i++)
+            addDamageRegion(&tracker->repaint, &tracker->history[i]);
+    }
+    tracker->full = regionArea(&tracker->repaint) == damageArea(&all);
+
+    if (tracker->setDamageRegion != NULL) {
+        EGLint rects[4 * DAMAGE_MAX_RECTS];
+        damageRegionToEGL(&tracker->repaint, rects);
+        tracker->setDamageRegion(tracker->display, tracker->surface, rects,
+                                 tracker->repaint.count);
+    }
+
+    return tracker->repaint.count;
+}
+
+// Scissors to repainted rectangle i, drawing outside it is wasted
+const DamageRect *scissorDamage(DamageTracker *tracker, int i)
+{
+    const DamageRect *rect = &tracker->repaint.rects[i];
+
+    if (tracker->full) {
+        cacheEnable(GL_SCISSOR_TEST, false);
+    } else {
+        cacheEnable(GL_SCISSOR_TEST, true);
+        glScissor(rect->x0, rect->y0, rect->x1 - rect->x0, rect->y1 - rect->y0);
+    }
+
+    return rect;
+}
+
+// Presents the frame and starts collecting damage for the next one
+void swapDamagedBuffers(DamageTracker *tracker)
+{
+    DamageRegion *current = &tracker->current;
+    GLint presented = regionArea(&tracker->repaint);
+
+    cacheEnable(GL_SCISSOR_TEST, false);
+    if (tracker->enabled && tracker->swapBuffersWithDamage != NULL) {
+        EGLint rects[4 * DAMAGE_MAX_RECTS];
+        damageRegionToEGL(current, rects);
+        tracker->swapBuffersWithDamage(tracker->display, tracker->surface, rects,
+                                       current->count);
+        presented = regionArea(current);
+    } else {
+        eglSwapBuffers(tracker->display, tracker->surface);
+    }
+
+    tracker->pixelsRepainted += regionArea(&tracker->repaint);
+    tracker->pixelsPresented += presented;
+    tracker->pixelsTotal += tracker->width * tracker->height;
+
+    memmove(&tracker->history[1], &tracker->history[0],
+            (DAMAGE_HISTORY - 1) * sizeof(DamageRegion));
+    tracker->history[0] = *current;
+    memset(current, 0, sizeof(DamageRegion));
+}
+
+#endif
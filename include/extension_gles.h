@@ -0,0 +1,35 @@
+#ifndef EXTENSION_GLES_H
+#define EXTENSION_GLES_H
+
+#include <GLES2/gl2.h>
+
+#include <string.h>
+
+// Extension checks for the GLES helpers: the context's list through
+// hasExtension(), EGL's from eglQueryString() through extensionListHas().
+
+// True when the space separated extensions list holds name
+bool extensionListHas(const char *extensions, const char *name)
+{
+    size_t length = strlen(name);
+
+    for (const char *match = extensions; match != NULL && *match != '\0'; match += length) {
+        match = strstr(match, name);
+        if (match == NULL)
+            break;
+        // whole space separated names only
+        if ((match == extensions || match[-1] == ' ') &&
+            (match[length] == ' ' || match[length] == '\0'))
+            return true;
+    }
+
+    return false;
+}
+
+// True when the current context advertises the extension name
+bool hasExtension(const char *name)
+{
+    return extensionListHas((const char *) glGetString(GL_EXTENSIONS), name);
+}
+
+#endif
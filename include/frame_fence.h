@@ -0,0 +1,181 @@
+#ifndef FRAME_FENCE_H
+#define FRAME_FENCE_H
+
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+// Bounds how many frames the CPU may queue ahead of the GPU. A fence goes
+// in after each frame is submitted; before building frame n the CPU waits
+// for the fence of frame n - depth. The slot returned by waitFrameSlot()
+// then belongs to the CPU again, so per-frame data kept in depth copies
+// (dynamic buffer rings) can be rewritten without stalling GL or racing it.
+//
+// GLES uses EGL_KHR_fence_sync on the current display, GL 3.3 uses core
+// sync objects; without fences frames aren't throttled. FRAMES_IN_FLIGHT
+// overrides the depth, 0 turns throttling off. Like vertex_format.h the GL
+// header is left to the includer.
+
+#define FRAME_FENCE_MAX_DEPTH   4
+#define FRAME_FENCE_TIMEOUT_NS  1000000000ull   // waits retry after this
+
+#if defined(GL_ES_VERSION_2_0)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <extension_gles.h>
+
+typedef EGLSyncKHR FrameFence;
+#else
+typedef GLsync FrameFence;
+#endif
+
+typedef struct _frameFences
+{
+    int depth;                  // 0 when not throttling
+    unsigned frame;             // frames fenced so far
+    FrameFence fences[FRAME_FENCE_MAX_DEPTH];
+
+#if defined(GL_ES_VERSION_2_0)
+    EGLDisplay display;
+    PFNEGLCREATESYNCKHRPROC createSync;
+    PFNEGLCLIENTWAITSYNCKHRPROC clientWaitSync;
+    PFNEGLDESTROYSYNCKHRPROC destroySync;
+#endif
+
+    double lastWait;            // seconds the CPU waited before this frame
+    double totalWait;
+    double maxWait;
+    int frames;                 // calls to waitFrameSlot()
+} FrameFences;
+
+#if defined(GL_ES_VERSION_2_0)
+bool initFenceApi(FrameFences *fences)
+{
+    fences->display = eglGetCurrentDisplay();
+    if (fences->display == EGL_NO_DISPLAY ||
+        !extensionListHas(eglQueryString(fences->display, EGL_EXTENSIONS), "EGL_KHR_fence_sync"))
+        return false;
+
+    fences->createSync = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress("eglCreateSyncKHR");
+    fences->clientWaitSync = (PFNEGLCLIENTWAITSYNCKHRPROC)
+        eglGetProcAddress("eglClientWaitSyncKHR");
+    fences->destroySync = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress("eglDestroySyncKHR");
+    return fences->createSync != NULL && fences->clientWaitSync != NULL &&
+           fences->destroySync != NULL;
+}
+
+FrameFence insertFence(FrameFences *fences)
+{
+    EGLSyncKHR sync = fences->createSync(fences->display, EGL_SYNC_FENCE_KHR, NULL);
+    return sync != EGL_NO_SYNC_KHR ? sync : NULL;
+}
+
+// Flushes, so the fence is sure to be reached
+void waitFence(FrameFences *fences, FrameFence fence)
+{
+    EGLint status;
+
+    do {
+        status = fences->clientWaitSync(fences->display, fence,
+                                        EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+                                        FRAME_FENCE_TIMEOUT_NS);
+    } while (status == EGL_TIMEOUT_EXPIRED_KHR);
+}
+
+void deleteFence(FrameFences *fences, FrameFence fence)
+{
+    fences->destroySync(fences->display, fence);
+}
+#else
+bool initFenceApi(FrameFences *fences)
+{
+    return true;
+}
+
+FrameFence insertFence(FrameFences *fences)
+{
+    return glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void waitFence(FrameFences *fences, FrameFence fence)
+{
+    GLenum status;
+
+    do {
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FRAME_FENCE_TIMEOUT_NS);
+    } while (status == GL_TIMEOUT_EXPIRED);
+}
+
+void deleteFence(FrameFences *fences, FrameFence fence)
+{
+    glDeleteSync(fence);
+}
+#endif
+
+// A context must be current. depth is clamped to FRAME_FENCE_MAX_DEPTH.
+void initFrameFences(FrameFences *fences, int depth)
+{
+    const char *inFlight = getenv("FRAMES_IN_FLIGHT");
+
+    memset(fences, 0, sizeof(FrameFences));
+    if (inFlight != NULL)
+        depth = atoi(inFlight);
+    depth = depth < 0 ? 0 : depth;
+    depth = depth > FRAME_FENCE_MAX_DEPTH ? FRAME_FENCE_MAX_DEPTH : depth;
+
+    if (depth > 0 && initFenceApi(fences))
+        fences->depth = depth;
+}
+
+// Call before building a frame. Waits until at most depth - 1 frames are
+// still queued and returns the slot, 0..depth - 1, this frame may rewrite.
+int waitFrameSlot(FrameFences *fences)
+{
+    fences->frames++;
+    fences->lastWait = 0.0;
+    if (fences->depth == 0)
+        return 0;
+
+    int slot = fences->frame % fences->depth;
+    FrameFence fence = fences->fences[slot];
+    if (fence != NULL) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        waitFence(fences, fence);
+        deleteFence(fences, fence);
+        fences->fences[slot] = NULL;
+
+        fences->lastWait = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        fences->totalWait += fences->lastWait;
+        if (fences->lastWait > fences->maxWait)
+            fences->maxWait = fences->lastWait;
+    }
+
+    return slot;
+}
+
+// Call once the frame is submitted, after the swap. A frame dropped after
+// waitFrameSlot() simply isn't fenced and leaves its slot free.
+void fenceFrame(FrameFences *fences)
+{
+    if (fences->depth == 0)
+        return;
+
+    fences->fences[fences->frame % fences->depth] = insertFence(fences);
+    fences->frame++;
+}
+
+// Waits for every frame still queued
+void destroyFrameFences(FrameFences *fences)
+{
+    for (int i = 0; i < fences->depth; i++) {
+        if (fences->fences[i] != NULL) {
+            waitFence(fences, fences->fences[i]);
+            deleteFence(fences, fences->fences[i]);
+            fences->fences[i] = NULL;
+        }
+    }
+}
+
+#endif
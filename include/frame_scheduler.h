@@ -0,0 +1,118 @@
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include <EGL/egl.h>
+#include <X11/Xlib.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <headless_egl.h>
+
+// On demand rendering for the X11/EGL samples. A frame is drawn only when
+// something marked the scene dirty (input, expose, a finished load) or while
+// the sample says it is animating; otherwise the loop sleeps on the X
+// connection until an event arrives. Frames that are drawn are paced by the
+// swap interval. RENDER_ON_DEMAND=0 draws every iteration, and so does the
+// headless backend, which has no events to wait for.
+//
+// A sample producing frames on another thread opens a wakeup pipe with
+// initFrameWakeup(); wakeFrameScheduler() then ends the wait from any thread.
+
+typedef struct _frameScheduler
+{
+    bool onDemand;
+    bool dirty;             // one more frame wanted
+    bool animating;         // set by the sample while anything moves
+    int framesDrawn;
+    int waits;              // times the loop went to sleep
+    int wakePipe[2];        // -1 without initFrameWakeup()
+} FrameScheduler;
+
+// swapInterval 1 syncs to the display, 0 draws as fast as possible
+void initFrameScheduler(FrameScheduler *scheduler, EGLDisplay display, EGLint swapInterval)
+{
+    const char *onDemand = getenv("RENDER_ON_DEMAND");
+
+    scheduler->onDemand = (onDemand == NULL || atoi(onDemand) != 0) && !headlessTarget.active;
+    scheduler->dirty = true;
+    scheduler->animating = false;
+    scheduler->framesDrawn = 0;
+    scheduler->waits = 0;
+    scheduler->wakePipe[0] = scheduler->wakePipe[1] = -1;
+
+    eglSwapInterval(display, swapInterval);
+}
+
+bool initFrameWakeup(FrameScheduler *scheduler)
+{
+    return pipe2(scheduler->wakePipe, O_NONBLOCK | O_CLOEXEC) == 0;
+}
+
+// Safe from any thread; a full pipe already means a wakeup is pending
+void wakeFrameScheduler(FrameScheduler *scheduler)
+{
+    char byte = 0;
+
+    if (scheduler->wakePipe[1] >= 0 && write(scheduler->wakePipe[1], &byte, 1) < 0)
+        return;
+}
+
+void destroyFrameScheduler(FrameScheduler *scheduler)
+{
+    for (int i = 0; i < 2; i++) {
+        if (scheduler->wakePipe[i] >= 0)
+            close(scheduler->wakePipe[i]);
+        scheduler->wakePipe[i] = -1;
+    }
+}
+
+void requestFrame(FrameScheduler *scheduler)
+{
+    scheduler->dirty = true;
+}
+
+// Once motion stops the last frame drawn was blended between two ticks, so
+// one more frame is drawn at rest
+void setAnimating(FrameScheduler *scheduler, bool animating)
+{
+    if (scheduler->animating && !animating)
+        scheduler->dirty = true;
+    scheduler->animating = animating;
+}
+
+// True when this iteration should draw, consumes the dirty flag
+bool beginFrame(FrameScheduler *scheduler)
+{
+    if (scheduler->onDemand && !scheduler->dirty && !scheduler->animating)
+        return false;
+
+    scheduler->dirty = false;
+    scheduler->framesDrawn++;
+    return true;
+}
+
+// Sleeps until the X connection has input, a wakeup arrives or timeoutMs
+// passes, -1 waits for input only. Call with the event queue drained.
+// Without a display (headless) only a wakeup or the timeout ends the wait.
+void waitForEvents(FrameScheduler *scheduler, Display *display, int timeoutMs)
+{
+    // XPending flushes our requests and reads anything already sent
+    if (display != NULL && XPending(display) > 0)
+        return;
+
+    // the wake pipe first, the X connection only with a display
+    struct pollfd fds[2] = { { scheduler->wakePipe[0], POLLIN, 0 },
+                             { display != NULL ? ConnectionNumber(display) : -1, POLLIN, 0 } };
+    poll(fds, 2, timeoutMs);
+    scheduler->waits++;
+
+    char drain[64];
+    if (scheduler->wakePipe[0] >= 0)
+        while (read(scheduler->wakePipe[0], drain, sizeof(drain)) > 0)
+            continue;
+}
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef GL_STATE_GLES_H
+#define GL_STATE_GLES_H
+
+#include <GLES2/gl2.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Mirror of the GL state the GLES samples change per draw: the program, the
+// active texture unit and the 2D texture on each unit, the array buffer,
+// the common enables and the blend function and depth mask. Calls that
+// would set what GL already has are dropped. Attribute enables and the
+// element buffer belong to the vertex array and are filtered by
+// vertex_array_gles.h instead.
+//
+// The mirror starts unknown, so the first call of each kind always reaches
+// GL. Code changing this state with raw GL calls calls invalidateGLState()
+// afterwards. GL_STATE_CACHE=0 forwards every call, the counters still run.
+
+#define GL_STATE_TEXTURE_UNITS  8       // units tracked, higher ones pass through
+
+// Capabilities mirrored by cacheEnable(), others pass through
+#define GL_STATE_BLEND          0
+#define GL_STATE_DEPTH_TEST     1
+#define GL_STATE_SCISSOR_TEST   2
+#define GL_STATE_CULL_FACE      3
+#define GL_STATE_STENCIL_TEST   4
+#define GL_STATE_CAPABILITIES   5
+
+typedef struct _glStateStats
+{
+    int issued;             // reached GL
+    int filtered;           // dropped as redundant
+} GLStateStats;
+
+typedef struct _glStateCache
+{
+    bool initialized;
+    bool enabled;
+
+    GLuint program;
+    GLuint activeUnit;
+    GLuint textures[GL_STATE_TEXTURE_UNITS];
+    bool texturesKnown[GL_STATE_TEXTURE_UNITS];
+    GLuint arrayBuffer;
+    bool arrayBufferKnown;
+    bool programKnown;
+    bool activeUnitKnown;
+    bool capabilities[GL_STATE_CAPABILITIES];
+    bool capabilitiesKnown[GL_STATE_CAPABILITIES];
+    GLenum blendSource;
+    GLenum blendDestination;
+    bool blendKnown;
+    GLboolean depthMask;
+    bool depthMaskKnown;
+
+    GLStateStats frame;     // since beginGLStateFrame()
+    GLStateStats total;     // of the finished frames
+    int frames;
+} GLStateCache;
+
+static GLStateCache glState;
+
+// GL changed behind the cache's back, the next call of each kind is issued
+void invalidateGLState()
+{
+    GLStateCache *state = &glState;
+
+    state->programKnown = false;
+    state->activeUnitKnown = false;
+    memset(state->texturesKnown, 0, sizeof(state->texturesKnown));
+    state->arrayBufferKnown = false;
+    memset(state->capabilitiesKnown, 0, sizeof(state->capabilitiesKnown));
+    state->blendKnown = false;
+    state->depthMaskKnown = false;
+}
+
+void initGLState()
+{
+    const char *cache = getenv("GL_STATE_CACHE");
+
+    memset(&glState, 0, sizeof(GLStateCache));
+    glState.initialized = true;
+    glState.enabled = cache == NULL || atoi(cache) != 0;
+    invalidateGLState();
+}
+
+// Counts a call and tells whether it has to reach GL
+bool glStateChanged(bool known, bool same)
+{
+    if (!glState.initialized)
+        initGLState();
+
+    if (glState.enabled && known && same) {
+        glState.frame.filtered++;
+        return false;
+    }
+
+    glState.frame.issued++;
+    return true;
+}
+
+// Closes the counters of the previous frame
+void beginGLStateFrame()
+{
+    GLStateCache *state = &glState;
+
+    state->total.issued += state->frame.issued;
+    state->total.filtered += state->frame.filtered;
+    state->frames++;
+    memset(&state->frame, 0, sizeof(GLStateStats));
+}
+
+void cacheUseProgram(GLuint program)
+{
+    if (!glStateChanged(glState.programKnown, glState.program == program))
+        return;
+
+    glUseProgram(program);
+    glState.program = program;
+    glState.programKnown = true;
+}
+
+// unit is GL_TEXTURE0 + n, like glActiveTexture
+void cacheActiveTexture(GLenum unit)
+{
+    GLuint index = unit - GL_TEXTURE0;
+
+    if (!glStateChanged(glState.activeUnitKnown, glState.activeUnit == index))
+        return;
+
+    glActiveTexture(unit);
+    glState.activeUnit = index;
+    glState.activeUnitKnown = true;
+}
+
+// GL_TEXTURE_2D on the active unit
+void cacheBindTexture(GLuint texture)
+{
+    GLuint unit = glState.activeUnit;
+    bool tracked = glState.activeUnitKnown && unit < GL_STATE_TEXTURE_UNITS;
+
+    if (!glStateChanged(tracked && glState.texturesKnown[unit],
+                        tracked && glState.textures[unit] == texture))
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (tracked) {
+        glState.textures[unit] = texture;
+        glState.texturesKnown[unit] = true;
+    }
+}
+
+// Deleting a bound texture binds 0 in its place, and its name may be reused
+void cacheDeleteTextures(GLsizei count, const GLuint *textures)
+{
+    for (GLsizei i = 0; i < count; i++) {
+        for (GLuint unit = 0; unit < GL_STATE_TEXTURE_UNITS; unit++) {
+            if (glState.textures[unit] == textures[i])
+                glState.textures[unit] = 0;
+        }
+    }
+
+    glDeleteTextures(count, textures);
+}
+
+// The element array buffer is vertex array state and passes through
+void cacheBindBuffer(GLenum target, GLuint buffer)
+{
+    if (target != GL_ARRAY_BUFFER) {
+        glBindBuffer(target, buffer);
+        return;
+    }
+
+    if (!glStateChanged(glState.arrayBufferKnown, glState.arrayBuffer == buffer))
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glState.arrayBuffer = buffer;
+    glState.arrayBufferKnown = true;
+}
+
+void cacheDeleteBuffers(GLsizei count, const GLuint *buffers)
+{
+    for (GLsizei i = 0; i < count; i++) {
+        if (glState.arrayBuffer == buffers[i])
+            glState.arrayBuffer = 0;
+    }
+
+    glDeleteBuffers(count, buffers);
+}
+
+int glStateCapability(GLenum capability)
+{
+    switch (capability) {
+    case GL_BLEND:          return GL_STATE_BLEND;
+    case GL_DEPTH_TEST:     return GL_STATE_DEPTH_TEST;
+    case GL_SCISSOR_TEST:   return GL_STATE_SCISSOR_TEST;
+    case GL_CULL_FACE:      return GL_STATE_CULL_FACE;
+    case GL_STENCIL_TEST:   return GL_STATE_STENCIL_TEST;
+    }
+    return -1;
+}
+
+// glEnable or glDisable
+void cacheEnable(GLenum capability, bool enable)
+{
+    int index = glStateCapability(capability);
+    bool tracked = index >= 0;
+
+    if (!glStateChanged(tracked && glState.capabilitiesKnown[index],
+                        tracked && glState.capabilities[index] == enable))
+        return;
+
+    if (enable)
+        glEnable(capability);
+    else
+        glDisable(capability);
+    if (tracked) {
+        glState.capabilities[index] = enable;
+        glState.capabilitiesKnown[index] = true;
+    }
+}
+
+void cacheBlendFunc(GLenum source, GLenum destination)
+{
+    if (!glStateChanged(glState.blendKnown, glState.blendSource == source &&
+                                            glState.blendDestination == destination))
+        return;
+
+    glBlendFunc(source, destination);
+    glState.blendSource = source;
+    glState.blendDestination = destination;
+    glState.blendKnown = true;
+}
+
+void cacheDepthMask(GLboolean write)
+{
+    if (!glStateChanged(glState.depthMaskKnown, glState.depthMask == write))
+        return;
+
+    glDepthMask(write);
+    glState.depthMask = write;
+    glState.depthMaskKnown = true;
+}
+
+#endif
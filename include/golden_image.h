@@ -0,0 +1,185 @@
+#ifndef GOLDEN_IMAGE_H
+#define GOLDEN_IMAGE_H
+
+#include <GLES2/gl2.h>
+#include <png.h>
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Regression mode for the GLES samples. --golden DIR renders GOLDEN_FRAMES
+// frames (--golden-frames N) on the headless backend with time advancing a
+// fixed GOLDEN_TIME_STEP per frame, reads the last one back and compares it
+// with DIR/<sample>.png. Pixels differ when their YIQ distance, the
+// perceptual metric of pixelmatch, is over GOLDEN_PIXEL_THRESHOLD of the
+// largest possible one; the check fails when more than GOLDEN_MAX_DIFFERENT
+// of them do, and leaves the frame in DIR/<sample>.actual.png. So does a
+// missing golden image; GOLDEN_UPDATE=1 writes the frame as the new one.
+// --golden-name NAME compares with DIR/NAME.png instead, for runs of a
+// sample with other options.
+
+#define GOLDEN_FRAMES           10
+#define GOLDEN_TIME_STEP        (1.0 / 60.0)
+#define GOLDEN_PIXEL_THRESHOLD  0.1
+#define GOLDEN_MAX_DIFFERENT    0.001   // fraction of the pixels
+#define GOLDEN_MAX_YIQ_DELTA    35215.0
+
+typedef struct _goldenTest
+{
+    bool enabled;
+    std::string path;           // the golden image
+    std::string actualPath;     // written on failure
+    int frames;
+} GoldenTest;
+
+static GoldenTest goldenTest;
+
+// Picks the --golden options out of the arguments and switches to the
+// headless backend. name identifies the sample's image.
+bool initGoldenTest(int argc, char *argv[], const char *name)
+{
+    GoldenTest *test = &goldenTest;
+
+    std::string directory;
+
+    test->enabled = false;
+    test->frames = GOLDEN_FRAMES;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            directory = argv[++i];
+            test->enabled = true;
+        } else if (strcmp(argv[i], "--golden-name") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (strcmp(argv[i], "--golden-frames") == 0 && i + 1 < argc) {
+            test->frames = atoi(argv[++i]);
+        }
+    }
+    if (!test->enabled)
+        return false;
+
+    test->path = directory + "/" + name + ".png";
+    test->actualPath = directory + "/" + name + ".actual.png";
+
+    std::string frames = std::to_string(test->frames);
+    setenv("ES_HEADLESS", "1", 1);
+    setenv("ES_HEADLESS_FRAMES", frames.c_str(), 1);
+    return true;
+}
+
+// Perceived difference of two RGB pixels, 0 to GOLDEN_MAX_YIQ_DELTA
+double yiqDelta(const unsigned char *a, const unsigned char *b)
+{
+    double r = a[0] - b[0], g = a[1] - b[1], bl = a[2] - b[2];
+    double y = r * 0.29889531 + g * 0.58662247 + bl * 0.11448223;
+    double i = r * 0.59597799 - g * 0.27417610 - bl * 0.32180189;
+    double q = r * 0.21147017 - g * 0.52261711 + bl * 0.31114694;
+
+    return 0.5053 * y * y + 0.299 * i * i + 0.1957 * q * q;
+}
+
+bool writeGoldenPng(const std::string &path, const std::vector<unsigned char> &pixels,
+                    GLint width, GLint height)
+{
+    png_image image;
+
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = width;
+    image.height = height;
+    image.format = PNG_FORMAT_RGB;
+    return png_image_write_to_file(&image, path.c_str(), 0, &pixels[0], 0, NULL) != 0;
+}
+
+bool readGoldenPng(const std::string &path, std::vector<unsigned char> *pixels,
+                   GLint *width, GLint *height)
+{
+    png_image image;
+
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, path.c_str()))
+        return false;
+
+    image.format = PNG_FORMAT_RGB;
+    pixels->resize(PNG_IMAGE_SIZE(image));
+    *width = image.width;
+    *height = image.height;
+    return png_image_finish_read(&image, NULL, &(*pixels)[0], 0, NULL) != 0;
+}
+
+// The current frame as top-down RGB rows
+void readFrame(GLint width, GLint height, std::vector<unsigned char> *pixels)
+{
+    std::vector<unsigned char> rgba(width * height * 4);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &rgba[0]);
+
+    pixels->resize(width * height * 3);
+    for (GLint y = 0; y < height; y++) {
+        const unsigned char *src = &rgba[(height - 1 - y) * width * 4];
+        unsigned char *dst = &(*pixels)[y * width * 3];
+        for (GLint x = 0; x < width; x++)
+            memcpy(&dst[x * 3], &src[x * 4], 3);
+    }
+}
+
+// Call after the last frame, returns the exit status: 0 matched or updated
+int finishGoldenTest(GLint width, GLint height)
+{
+    GoldenTest *test = &goldenTest;
+    const char *update = getenv("GOLDEN_UPDATE");
+    std::vector<unsigned char> actual, golden;
+    GLint goldenWidth, goldenHeight;
+
+    readFrame(width, height, &actual);
+
+    if (update != NULL && atoi(update) != 0) {
+        if (!writeGoldenPng(test->path, actual, width, height)) {
+            std::cout << "Golden: can't write " << test->path << std::endl;
+            return 1;
+        }
+        std::cout << "Golden: wrote " << test->path << std::endl;
+        return 0;
+    }
+
+    if (!readGoldenPng(test->path, &golden, &goldenWidth, &goldenHeight)) {
+        writeGoldenPng(test->actualPath, actual, width, height);
+        std::cout << "Golden: FAILED, can't read " << test->path << ", the frame is in "
+                  << test->actualPath << std::endl;
+        return 1;
+    }
+
+    if (goldenWidth != width || goldenHeight != height) {
+        std::cout << "Golden: " << test->path << " is " << goldenWidth << "x" << goldenHeight
+                  << ", the frame " << width << "x" << height << std::endl;
+        writeGoldenPng(test->actualPath, actual, width, height);
+        return 1;
+    }
+
+    double threshold = GOLDEN_MAX_YIQ_DELTA * GOLDEN_PIXEL_THRESHOLD * GOLDEN_PIXEL_THRESHOLD;
+    long different = 0;
+    double worst = 0.0;
+    for (long i = 0; i < (long) width * height; i++) {
+        double delta = yiqDelta(&actual[i * 3], &golden[i * 3]);
+        if (delta > threshold)
+            different++;
+        worst = delta > worst ? delta : worst;
+    }
+
+    long allowed = (long) (GOLDEN_MAX_DIFFERENT * width * height);
+    std::cout << "Golden: " << different << " of " << (long) width * height
+              << " pixels differ from " << test->path << " (" << allowed << " allowed, worst "
+              << worst / GOLDEN_MAX_YIQ_DELTA << ")" << std::endl;
+    if (different <= allowed)
+        return 0;
+
+    writeGoldenPng(test->actualPath, actual, width, height);
+    std::cout << "Golden: FAILED, the frame is in " << test->actualPath << std::endl;
+    return 1;
+}
+
+#endif
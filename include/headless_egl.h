@@ -0,0 +1,195 @@
+#ifndef HEADLESS_EGL_H
+#define HEADLESS_EGL_H
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <chrono>
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+#include <extension_gles.h>
+
+// Offscreen backend for the GLES samples' esCreateWindow(), for machines
+// without X or a GPU (Mesa llvmpipe). The context renders to a pbuffer of
+// the window's size on the EGL_MESA_platform_surfaceless display when there
+// is one, the default display otherwise. Without a pbuffer config for the
+// window's attributes it binds a framebuffer object in place of the default
+// one, with the context current on no surface (EGL_KHR_surfaceless_context)
+// or, where that is missing, on a 1x1 pbuffer of any config.
+//
+// ES_HEADLESS=1 selects it, ES_HEADLESS=0 never does and without the
+// variable it is used when DISPLAY isn't set. There are no events, so
+// samples draw every iteration and stop after ES_HEADLESS_FRAMES frames.
+
+#define HEADLESS_DEFAULT_FRAMES 300
+
+typedef struct _headlessTarget
+{
+    bool active;
+    EGLSurface surface;         // the pbuffer, 1x1 or EGL_NO_SURFACE with the FBO
+    GLuint framebuffer;         // 0 when drawing to the pbuffer
+    GLuint renderbuffers[2];    // color, depth/stencil
+    int frames;
+    int maxFrames;
+    std::chrono::steady_clock::time_point start;
+} HeadlessTarget;
+
+static HeadlessTarget headlessTarget;
+
+bool headlessRequested()
+{
+    const char *headless = getenv("ES_HEADLESS");
+    const char *display = getenv("DISPLAY");
+
+    if (headless != NULL)
+        return atoi(headless) != 0;
+    return display == NULL || display[0] == '\0';
+}
+
+EGLDisplay headlessDisplay()
+{
+    const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    if (extensionListHas(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+            eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay != NULL)
+            return getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+// Color, depth and stencil renderbuffers standing in for a window
+bool createHeadlessFramebuffer(HeadlessTarget *target, GLint width, GLint height,
+                               bool depth, bool stencil)
+{
+    GLenum color = hasExtension("GL_OES_rgb8_rgba8") ? GL_RGBA8_OES : GL_RGB565;
+
+    glGenFramebuffers(1, &target->framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+    glGenRenderbuffers(2, target->renderbuffers);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, target->renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, color, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+                              target->renderbuffers[0]);
+
+    // ES2 only combines them with GL_OES_packed_depth_stencil, without it
+    // stencil only goes along without depth
+    if (depth && stencil && hasExtension("GL_OES_packed_depth_stencil")) {
+        glBindRenderbuffer(GL_RENDERBUFFER, target->renderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8_OES, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
+                                  target->renderbuffers[1]);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+                                  target->renderbuffers[1]);
+    } else if (depth || stencil) {
+        glBindRenderbuffer(GL_RENDERBUFFER, target->renderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, depth ? GL_DEPTH_COMPONENT16 : GL_STENCIL_INDEX8,
+                              width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                                  depth ? GL_DEPTH_ATTACHMENT : GL_STENCIL_ATTACHMENT,
+                                  GL_RENDERBUFFER, target->renderbuffers[1]);
+    }
+
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+// attribList as for a window, EGL_SURFACE_TYPE is added here
+EGLBoolean createHeadlessContext(const EGLint attribList[], GLint width, GLint height,
+                                 EGLDisplay *eglDisplay, EGLContext *eglContext,
+                                 EGLSurface *eglSurface)
+{
+    HeadlessTarget *target = &headlessTarget;
+    const char *frames = getenv("ES_HEADLESS_FRAMES");
+    EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+    EGLint pbufferAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    std::vector<EGLint> attribs;
+    bool depth = false, stencil = false;
+    EGLConfig config;
+    EGLint numConfigs = 0;
+
+    for (int i = 0; attribList[i] != EGL_NONE; i += 2) {
+        if (attribList[i] == EGL_DEPTH_SIZE)
+            depth = attribList[i + 1] != EGL_DONT_CARE && attribList[i + 1] > 0;
+        if (attribList[i] == EGL_STENCIL_SIZE)
+            stencil = attribList[i + 1] != EGL_DONT_CARE && attribList[i + 1] > 0;
+        attribs.push_back(attribList[i]);
+        attribs.push_back(attribList[i + 1]);
+    }
+    attribs.push_back(EGL_RENDERABLE_TYPE);
+    attribs.push_back(EGL_OPENGL_ES2_BIT);
+    attribs.push_back(EGL_SURFACE_TYPE);
+    attribs.push_back(EGL_PBUFFER_BIT);
+    attribs.push_back(EGL_NONE);
+
+    EGLDisplay display = headlessDisplay();
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+        return EGL_FALSE;
+
+    target->surface = EGL_NO_SURFACE;
+    if (eglChooseConfig(display, &attribs[0], &config, 1, &numConfigs) && numConfigs > 0)
+        target->surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+
+    // no pbuffer as asked: any config, drawing into an FBO
+    bool offscreen = target->surface == EGL_NO_SURFACE;
+    if (offscreen) {
+        bool surfaceless = extensionListHas(eglQueryString(display, EGL_EXTENSIONS),
+                                            "EGL_KHR_surfaceless_context");
+        EGLint anyAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+                                EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT, EGL_NONE };
+        EGLint tinyAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+
+        if (!eglChooseConfig(display, anyAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+            return EGL_FALSE;
+        if (!surfaceless) {
+            target->surface = eglCreatePbufferSurface(display, config, tinyAttribs);
+            if (target->surface == EGL_NO_SURFACE)
+                return EGL_FALSE;
+        }
+    }
+
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (context == EGL_NO_CONTEXT)
+        return EGL_FALSE;
+    if (!eglMakeCurrent(display, target->surface, target->surface, context))
+        return EGL_FALSE;
+    if (offscreen && !createHeadlessFramebuffer(target, width, height, depth, stencil))
+        return EGL_FALSE;
+
+    target->active = true;
+    target->frames = 0;
+    target->maxFrames = frames != NULL ? atoi(frames) : HEADLESS_DEFAULT_FRAMES;
+    target->start = std::chrono::steady_clock::now();
+
+    std::cout << "Headless: " << width << "x" << height << " "
+              << (target->framebuffer != 0 ? "framebuffer object" : "pbuffer") << " on "
+              << glGetString(GL_RENDERER) << std::endl;
+
+    *eglDisplay = display;
+    *eglContext = context;
+    *eglSurface = target->surface;
+    return EGL_TRUE;
+}
+
+// Counts loop iterations, true once ES_HEADLESS_FRAMES have run
+bool headlessFinished()
+{
+    HeadlessTarget *target = &headlessTarget;
+
+    if (target->frames++ < target->maxFrames)
+        return false;
+
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - target->start).count();
+    std::cout << "Headless: " << target->maxFrames << " frames in " << seconds << " s, "
+              << target->maxFrames / seconds << " frames/s" << std::endl;
+    return true;
+}
+
+#endif
@@ -0,0 +1,403 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <image_decoder.h>
+
+// On-disk cache of decoded, converted and mipmapped images. Entries are keyed
+// by a hash of the source file contents plus the conversion parameters, and
+// read back with a single mmap. The least recently used entries are deleted
+// once the cache grows past IMAGE_CACHE_MAX_BYTES, down to
+// IMAGE_CACHE_TRIM_PERCENT of it so the next trim is many writes away.
+
+#define IMAGE_CACHE_MAGIC       0x43494c47  // "GLIC"
+#define IMAGE_CACHE_VERSION     1
+#define IMAGE_CACHE_MAX_LEVELS  16
+#define IMAGE_CACHE_MAX_BYTES   (256u * 1024u * 1024u)
+#define IMAGE_CACHE_TRIM_PERCENT 75
+
+typedef struct _imageCacheParams
+{
+    int channels;       // 3 or 4, 0 keeps what the decoder produced
+    bool mipmaps;
+} ImageCacheParams;
+
+typedef struct _imageCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t contentHash;
+    uint64_t paramsHash;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t levels;
+    uint64_t offsets[IMAGE_CACHE_MAX_LEVELS];  // from the start of the file
+} ImageCacheHeader;
+
+typedef struct _cachedImage
+{
+    void *map;
+    size_t mapSize;
+    bool heap;          // entry could not be written and lives in memory
+    const ImageCacheHeader *header;
+} CachedImage;
+
+// Size of the cache directory as of the last trim plus what this process
+// wrote since. Writes only scan the directory when it may be over the limit.
+typedef struct _imageCacheUsage
+{
+    bool known;
+    size_t bytes;
+} ImageCacheUsage;
+
+static ImageCacheUsage imageCacheUsage;
+
+uint64_t hashBytes(const unsigned char *data, size_t size, uint64_t seed)
+{
+    const uint64_t prime = 0x100000001b3ull;
+    uint64_t hash = seed ^ 0xcbf29ce484222325ull;
+    size_t i = 0;
+
+    // FNV-1a style, but over 64-bit words so warm lookups stay far cheaper
+    // than a decode. The multiply only carries upwards, so each round folds
+    // the high half down to let a word's top bits reach the low ones. The
+    // tail bytes are plain FNV-1a.
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ data[i]) * prime;
+
+    return hash ^ size;
+}
+
+std::string imageCacheDir()
+{
+    const char *dir = getenv("IMAGE_CACHE_DIR");
+    if (dir != NULL)
+        return dir;
+
+    std::string path;
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (xdg != NULL)
+        path = xdg;
+    else if (home != NULL)
+        path = std::string(home) + "/.cache";
+    else
+        path = "/tmp";
+    mkdir(path.c_str(), 0755);
+
+    return path + "/opengl_exp";
+}
+
+size_t imageCacheMaxBytes()
+{
+    const char *max = getenv("IMAGE_CACHE_MAX_BYTES");
+
+    return max != NULL ? strtoull(max, NULL, 10) : IMAGE_CACHE_MAX_BYTES;
+}
+
+// When the cache is over maxBytes, drops least recently used entries until
+// it fits in IMAGE_CACHE_TRIM_PERCENT of that. Returns the bytes left.
+size_t imageCacheTrim(size_t maxBytes)
+{
+    std::string dirPath = imageCacheDir();
+    DIR *dir = opendir(dirPath.c_str());
+    if (dir == NULL)
+        return 0;
+
+    std::vector<std::pair<int64_t, std::string> > entries;
+    size_t total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *ext = strrchr(entry->d_name, '.');
+        struct stat st;
+        std::string path = dirPath + "/" + entry->d_name;
+
+        if (ext == NULL || strcmp(ext, ".img") != 0 || stat(path.c_str(), &st) != 0)
+            continue;
+
+        int64_t used = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        entries.push_back(std::make_pair(used, path));
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    if (total <= maxBytes)
+        return total;
+
+    // the newest entry is the one just written, always keep it
+    size_t target = maxBytes / 100 * IMAGE_CACHE_TRIM_PERCENT;
+    std::sort(entries.begin(), entries.end());
+    for (size_t i = 0; i + 1 < entries.size() && total > target; i++) {
+        struct stat st;
+        if (stat(entries[i].second.c_str(), &st) == 0 &&
+            unlink(entries[i].second.c_str()) == 0)
+            total -= st.st_size;
+    }
+
+    return total;
+}
+
+// Counts a new entry of size bytes, trimming the first time and whenever
+// the count goes over the limit. Other processes' writes are only seen then.
+void imageCacheAdded(size_t size)
+{
+    ImageCacheUsage *usage = &imageCacheUsage;
+    size_t maxBytes = imageCacheMaxBytes();
+
+    if (usage->known && usage->bytes + size <= maxBytes) {
+        usage->bytes += size;
+        return;
+    }
+
+    usage->bytes = imageCacheTrim(maxBytes);
+    usage->known = true;
+}
+
+bool imageCacheMap(const std::string &path, uint64_t contentHash,
+                   uint64_t paramsHash, CachedImage *cached)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ImageCacheHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const ImageCacheHeader *header = (const ImageCacheHeader *) map;
+    bool valid = header->magic == IMAGE_CACHE_MAGIC &&
+                 header->version == IMAGE_CACHE_VERSION &&
+                 header->contentHash == contentHash &&
+                 header->paramsHash == paramsHash &&
+                 header->levels > 0 && header->levels <= IMAGE_CACHE_MAX_LEVELS;
+
+    // the last level must end inside the file or the entry was truncated
+    if (valid) {
+        uint32_t last = header->levels - 1;
+        uint64_t w = std::max(1u, header->width >> last);
+        uint64_t h = std::max(1u, header->height >> last);
+        valid = header->offsets[last] + w * h * header->channels <= (uint64_t) st.st_size;
+    }
+
+    if (!valid) {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    // refresh the LRU timestamp
+    utimensat(AT_FDCWD, path.c_str(), NULL, 0);
+
+    cached->map = map;
+    cached->mapSize = st.st_size;
+    cached->heap = false;
+    cached->header = header;
+    return true;
+}
+
+// 2x2 box filter, clamping at odd edges
+void downsampleLevel(const unsigned char *src, int srcW, int srcH,
+                     unsigned char *dst, int dstW, int dstH, int channels)
+{
+    for (int y = 0; y < dstH; y++) {
+        int y0 = std::min(y * 2, srcH - 1);
+        int y1 = std::min(y * 2 + 1, srcH - 1);
+
+        for (int x = 0; x < dstW; x++) {
+            int x0 = std::min(x * 2, srcW - 1);
+            int x1 = std::min(x * 2 + 1, srcW - 1);
+
+            for (int c = 0; c < channels; c++) {
+                int sum = src[(y0 * srcW + x0) * channels + c] +
+                          src[(y0 * srcW + x1) * channels + c] +
+                          src[(y1 * srcW + x0) * channels + c] +
+                          src[(y1 * srcW + x1) * channels + c];
+                dst[(y * dstW + x) * channels + c] = (unsigned char) ((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+// Lays out the header and every level in one malloc'd block
+unsigned char *imageCacheBuild(const Image &image, uint64_t contentHash,
+                               uint64_t paramsHash, const ImageCacheParams &params,
+                               size_t *size)
+{
+    ImageCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = IMAGE_CACHE_MAGIC;
+    header.version = IMAGE_CACHE_VERSION;
+    header.contentHash = contentHash;
+    header.paramsHash = paramsHash;
+    header.width = image.width;
+    header.height = image.height;
+    header.channels = params.channels != 0 ? params.channels : image.channels;
+    header.levels = 1;
+    if (params.mipmaps) {
+        while (header.levels < IMAGE_CACHE_MAX_LEVELS &&
+               ((header.width >> header.levels) > 0 || (header.height >> header.levels) > 0))
+            header.levels++;
+    }
+
+    uint64_t offset = sizeof(header);
+    for (uint32_t i = 0; i < header.levels; i++) {
+        header.offsets[i] = offset;
+        offset += (uint64_t) std::max(1u, header.width >> i) *
+                  std::max(1u, header.height >> i) * header.channels;
+    }
+
+    unsigned char *data = (unsigned char *) malloc(offset);
+    memcpy(data, &header, sizeof(header));
+
+    // convert into level 0, then build each level from the previous one
+    unsigned char *level = data + header.offsets[0];
+    int pixels = image.width * image.height;
+    for (int i = 0; i < pixels; i++) {
+        const unsigned char *src = image.pixels + i * image.channels;
+        unsigned char *dst = level + i * header.channels;
+
+        memcpy(dst, src, std::min<int>(image.channels, header.channels));
+        if (header.channels == 4 && image.channels == 3)
+            dst[3] = 255;
+    }
+
+    for (uint32_t i = 1; i < header.levels; i++) {
+        downsampleLevel(data + header.offsets[i - 1],
+                        std::max(1u, header.width >> (i - 1)),
+                        std::max(1u, header.height >> (i - 1)),
+                        data + header.offsets[i],
+                        std::max(1u, header.width >> i),
+                        std::max(1u, header.height >> i), header.channels);
+    }
+
+    *size = offset;
+    return data;
+}
+
+bool imageCacheWrite(const std::string &path, const unsigned char *data, size_t size)
+{
+    // write to a temporary name so readers never see a partial entry
+    std::string tmpPath = path + ".tmp." + std::to_string(getpid());
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (file == NULL)
+        return false;
+
+    bool written = fwrite(data, 1, size, file) == size;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Returns the cached pixels for img_file, decoding and storing them on a miss
+bool imageCacheLoad(const char *img_file, const ImageDecoder *decoder,
+                    const ImageCacheParams &params, CachedImage *cached)
+{
+    int fd = open(img_file, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *source = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (source == MAP_FAILED)
+        return false;
+
+    uint64_t contentHash = hashBytes((const unsigned char *) source, st.st_size, 0);
+    uint64_t paramsHash = hashBytes((const unsigned char *) decoder->name,
+                                    strlen(decoder->name),
+                                    (uint64_t) params.channels << 1 | params.mipmaps);
+
+    std::string dir = imageCacheDir();
+    char name[64];
+    snprintf(name, sizeof(name), "/%016llx-%016llx.img",
+             (unsigned long long) contentHash, (unsigned long long) paramsHash);
+    std::string path = dir + name;
+
+    if (imageCacheMap(path, contentHash, paramsHash, cached)) {
+        munmap(source, st.st_size);
+        return true;
+    }
+
+    Image image;
+    bool decoded = decoder->decode((const unsigned char *) source, st.st_size, &image);
+    munmap(source, st.st_size);
+    if (!decoded)
+        return false;
+
+    size_t size;
+    unsigned char *data = imageCacheBuild(image, contentHash, paramsHash, params, &size);
+    decoder->release(&image);
+
+    mkdir(dir.c_str(), 0755);
+    if (imageCacheWrite(path, data, size)) {
+        imageCacheAdded(size);
+        if (imageCacheMap(path, contentHash, paramsHash, cached)) {
+            free(data);
+            return true;
+        }
+    }
+
+    // still usable for this run, it just won't be warm next time
+    std::cout << "Failed to write image cache entry " << path << std::endl;
+    cached->map = data;
+    cached->mapSize = size;
+    cached->heap = true;
+    cached->header = (const ImageCacheHeader *) data;
+    return true;
+}
+
+const unsigned char *cachedImageLevel(const CachedImage *cached, int level,
+                                      int *width, int *height)
+{
+    *width = std::max(1u, cached->header->width >> level);
+    *height = std::max(1u, cached->header->height >> level);
+
+    return (const unsigned char *) cached->map + cached->header->offsets[level];
+}
+
+void imageCacheRelease(CachedImage *cached)
+{
+    if (cached->heap)
+        free(cached->map);
+    else if (cached->map != NULL)
+        munmap(cached->map, cached->mapSize);
+    memset(cached, 0, sizeof(CachedImage));
+}
+
+#endif
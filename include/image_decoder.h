@@ -0,0 +1,248 @@
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+// stb_image is vendored, so that backend is always available. SDL_image and
+// libjpeg-turbo are compiled in when the build defines HAVE_SDL_IMAGE and
+// HAVE_LIBJPEG_TURBO respectively.
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#ifdef HAVE_SDL_IMAGE
+#include <SDL.h>
+#include <SDL_image.h>
+#endif
+
+#ifdef HAVE_LIBJPEG_TURBO
+#include <jpeglib.h>
+#endif
+
+#ifndef IMAGE_DECODER_DEFAULT
+#define IMAGE_DECODER_DEFAULT "stb_image"
+#endif
+
+// Decoded pixels are always tightly packed RGB or RGBA rows, top row first
+typedef struct _image
+{
+    unsigned char *pixels;
+    int width;
+    int height;
+    int channels;
+
+    void *priv;     // backend-owned storage, freed by release()
+} Image;
+
+typedef struct _imageDecoder
+{
+    const char *name;
+    bool (*decode)(const unsigned char *data, size_t size, Image *image);
+    void (*release)(Image *image);
+} ImageDecoder;
+
+bool stbDecode(const unsigned char *data, size_t size, Image *image)
+{
+    int width, height, channels;
+
+    if (!stbi_info_from_memory(data, (int) size, &width, &height, &channels))
+        return false;
+
+    // grey and grey+alpha are expanded so callers only deal with RGB(A)
+    int wanted = (channels == 2 || channels == 4) ? 4 : 3;
+    image->pixels = stbi_load_from_memory(data, (int) size, &image->width,
+                                          &image->height, &channels, wanted);
+    image->channels = wanted;
+    image->priv = image->pixels;
+
+    return image->pixels != NULL;
+}
+
+void stbRelease(Image *image)
+{
+    stbi_image_free(image->priv);
+    memset(image, 0, sizeof(Image));
+}
+
+#ifdef HAVE_SDL_IMAGE
+bool sdlDecode(const unsigned char *data, size_t size, Image *image)
+{
+    SDL_Surface *surface = IMG_Load_RW(SDL_RWFromConstMem(data, (int) size), 1);
+    if (surface == NULL)
+        return false;
+
+    int channels = surface->format->BytesPerPixel;
+    if (channels != 3 && channels != 4) {
+        SDL_FreeSurface(surface);
+        return false;
+    }
+
+    image->width = surface->w;
+    image->height = surface->h;
+    image->channels = channels;
+    image->priv = surface;
+
+    // SDL pads rows to 4 bytes and may hand back BGR order, repack if so
+    bool swap = surface->format->Rmask != 0x000000ff;
+    int rowSize = surface->w * channels;
+    if (surface->pitch == rowSize && !swap) {
+        image->pixels = (unsigned char *) surface->pixels;
+        return true;
+    }
+
+    image->pixels = (unsigned char *) malloc(rowSize * surface->h);
+    for (int y = 0; y < surface->h; y++) {
+        unsigned char *src = (unsigned char *) surface->pixels + y * surface->pitch;
+        unsigned char *dst = image->pixels + y * rowSize;
+
+        memcpy(dst, src, rowSize);
+        if (swap) {
+            for (int x = 0; x < rowSize; x += channels) {
+                dst[x] = src[x + 2];
+                dst[x + 2] = src[x];
+            }
+        }
+    }
+
+    return true;
+}
+
+void sdlRelease(Image *image)
+{
+    SDL_Surface *surface = (SDL_Surface *) image->priv;
+
+    if (surface != NULL && image->pixels != surface->pixels)
+        free(image->pixels);
+    SDL_FreeSurface(surface);
+    memset(image, 0, sizeof(Image));
+}
+#endif
+
+#ifdef HAVE_LIBJPEG_TURBO
+typedef struct _jpegError
+{
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} JpegError;
+
+void jpegErrorExit(j_common_ptr cinfo)
+{
+    // libjpeg's default handler calls exit(), bail out to the decoder instead
+    longjmp(((JpegError *) cinfo->err)->jump, 1);
+}
+
+bool turboDecode(const unsigned char *data, size_t size, Image *image)
+{
+    struct jpeg_decompress_struct cinfo;
+    JpegError err;
+
+    image->pixels = NULL;
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpegErrorExit;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(image->pixels);
+        image->pixels = NULL;
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *) data, size);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+
+    image->width = cinfo.output_width;
+    image->height = cinfo.output_height;
+    image->channels = 3;
+    image->pixels = (unsigned char *) malloc(image->width * image->height * 3);
+    image->priv = image->pixels;
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = image->pixels + cinfo.output_scanline * image->width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return true;
+}
+
+void turboRelease(Image *image)
+{
+    free(image->priv);
+    memset(image, 0, sizeof(Image));
+}
+#endif
+
+const ImageDecoder imageDecoders[] =
+{
+#ifdef HAVE_SDL_IMAGE
+    { "sdl_image", sdlDecode, sdlRelease },
+#endif
+    { "stb_image", stbDecode, stbRelease },
+#ifdef HAVE_LIBJPEG_TURBO
+    { "libjpeg_turbo", turboDecode, turboRelease },
+#endif
+};
+
+const int numImageDecoders = sizeof(imageDecoders) / sizeof(imageDecoders[0]);
+
+const ImageDecoder *findImageDecoder(const char *name)
+{
+    for (int i = 0; i < numImageDecoders; i++) {
+        if (strcmp(imageDecoders[i].name, name) == 0)
+            return &imageDecoders[i];
+    }
+
+    return NULL;
+}
+
+// The backend picked at build time with -Dimage_decoder
+const ImageDecoder *defaultImageDecoder()
+{
+    const ImageDecoder *decoder = findImageDecoder(IMAGE_DECODER_DEFAULT);
+
+    return decoder != NULL ? decoder : &imageDecoders[0];
+}
+
+unsigned char *readImageFile(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char *data = (unsigned char *) malloc(length > 0 ? length : 1);
+    if (length <= 0 || fread(data, 1, length, file) != (size_t) length) {
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    *size = length;
+    return data;
+}
+
+bool decodeImageFile(const ImageDecoder *decoder, const char *path, Image *image)
+{
+    size_t size;
+    unsigned char *data = readImageFile(path, &size);
+    if (data == NULL)
+        return false;
+
+    bool decoded = decoder->decode(data, size, image);
+    free(data);
+
+    return decoded;
+}
+
+#endif
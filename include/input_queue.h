@@ -0,0 +1,72 @@
+#ifndef INPUT_QUEUE_H
+#define INPUT_QUEUE_H
+
+#include <atomic>
+#include <stdint.h>
+
+// Window system events reduced to fixed size records and handed from one
+// producer thread to one consumer thread through a lock-free ring. The
+// producer only writes head and the consumer only writes tail, so neither
+// ever waits; when the ring is full new events are dropped and counted.
+
+#define INPUT_QUEUE_SIZE        256     // power of two
+
+#define INPUT_KEY_PRESS         0
+#define INPUT_KEY_RELEASE       1
+#define INPUT_POINTER_MOTION    2
+#define INPUT_EXPOSE            3
+#define INPUT_CLOSE             4
+
+typedef struct _inputEvent
+{
+    uint32_t type;
+    uint32_t key;           // keysym for key events
+    int16_t x, y;           // pointer position in window pixels
+    uint32_t serverTime;    // window system timestamp in ms, 0 when it has none
+    double time;            // steady clock seconds when the event was read
+} InputEvent;
+
+typedef struct _inputQueue
+{
+    InputEvent events[INPUT_QUEUE_SIZE];
+    std::atomic<unsigned> head;     // next slot written, producer only
+    std::atomic<unsigned> tail;     // next slot read, consumer only
+    unsigned dropped;               // producer only
+} InputQueue;
+
+void initInputQueue(InputQueue *queue)
+{
+    queue->head.store(0);
+    queue->tail.store(0);
+    queue->dropped = 0;
+}
+
+// Producer side, false when the queue is full and the event was dropped
+bool pushInputEvent(InputQueue *queue, const InputEvent *event)
+{
+    unsigned head = queue->head.load(std::memory_order_relaxed);
+
+    if (head - queue->tail.load(std::memory_order_acquire) == INPUT_QUEUE_SIZE) {
+        queue->dropped++;
+        return false;
+    }
+
+    queue->events[head & (INPUT_QUEUE_SIZE - 1)] = *event;
+    queue->head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+// Consumer side, false when the queue is empty
+bool popInputEvent(InputQueue *queue, InputEvent *event)
+{
+    unsigned tail = queue->tail.load(std::memory_order_relaxed);
+
+    if (tail == queue->head.load(std::memory_order_acquire))
+        return false;
+
+    *event = queue->events[tail & (INPUT_QUEUE_SIZE - 1)];
+    queue->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef INPUT_THREAD_X11_H
+#define INPUT_THREAD_X11_H
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+
+#include <input_queue.h>
+#include <frame_scheduler.h>
+
+// Reads the input of a window on a thread of its own. The thread opens a
+// second X connection and selects the window's events on it, so the render
+// thread's connection (which EGL uses) is never touched from two threads
+// and Xlib needs no locking. It sleeps in poll() on the connection, turns
+// each event into an InputEvent stamped with the time it was read, queues
+// it and wakes the frame scheduler; the frame loop drains the queue.
+
+typedef struct _inputThread
+{
+    Display *display;       // the thread's own connection
+    Window window;
+    FrameScheduler *scheduler;
+    InputQueue queue;
+    std::thread thread;
+    int stopPipe[2];
+    int eventsRead;         // input thread only
+} InputThread;
+
+double inputClock()
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// False for events the samples don't use
+bool translateInputEvent(XEvent *xev, InputEvent *event)
+{
+    memset(event, 0, sizeof(InputEvent));
+    event->time = inputClock();
+
+    switch (xev->type) {
+    case KeyPress:
+    case KeyRelease:
+        event->type = xev->type == KeyPress ? INPUT_KEY_PRESS : INPUT_KEY_RELEASE;
+        event->key = XLookupKeysym(&xev->xkey, 0);
+        event->x = xev->xkey.x;
+        event->y = xev->xkey.y;
+        event->serverTime = xev->xkey.time;
+        return true;
+    case MotionNotify:
+        event->type = INPUT_POINTER_MOTION;
+        event->x = xev->xmotion.x;
+        event->y = xev->xmotion.y;
+        event->serverTime = xev->xmotion.time;
+        return true;
+    case Expose:
+        // the last of a series covers the rest
+        event->type = INPUT_EXPOSE;
+        return xev->xexpose.count == 0;
+    case DestroyNotify:
+        event->type = INPUT_CLOSE;
+        return true;
+    }
+
+    return false;
+}
+
+void inputThreadMain(InputThread *input)
+{
+    struct pollfd fds[2] = { { ConnectionNumber(input->display), POLLIN, 0 },
+                             { input->stopPipe[0], POLLIN, 0 } };
+
+    for (;;) {
+        bool queued = false;
+
+        while (XPending(input->display) > 0) {
+            XEvent xev;
+            InputEvent event;
+
+            XNextEvent(input->display, &xev);
+            input->eventsRead++;
+            if (translateInputEvent(&xev, &event))
+                queued |= pushInputEvent(&input->queue, &event);
+        }
+        if (queued)
+            wakeFrameScheduler(input->scheduler);
+
+        poll(fds, 2, -1);
+        if (fds[1].revents != 0)
+            return;
+    }
+}
+
+// eventMask as for XSelectInput. The scheduler needs initFrameWakeup() for
+// queued events to end its wait. False without a window (headless) or a
+// second X connection.
+bool startInputThread(InputThread *input, Window window, long eventMask,
+                      FrameScheduler *scheduler)
+{
+    initInputQueue(&input->queue);
+    input->window = window;
+    input->scheduler = scheduler;
+    input->eventsRead = 0;
+    input->stopPipe[0] = input->stopPipe[1] = -1;
+
+    input->display = NULL;
+    if (window == None)
+        return false;
+
+    input->display = XOpenDisplay(NULL);
+    if (input->display == NULL)
+        return false;
+    if (pipe2(input->stopPipe, O_CLOEXEC) != 0) {
+        XCloseDisplay(input->display);
+        input->display = NULL;
+        return false;
+    }
+
+    XSelectInput(input->display, window, eventMask);
+    XFlush(input->display);
+
+    input->thread = std::thread(inputThreadMain, input);
+    return true;
+}
+
+void stopInputThread(InputThread *input)
+{
+    if (input->display == NULL)
+        return;
+
+    // an empty pipe always takes the byte
+    char byte = 0;
+    if (write(input->stopPipe[1], &byte, 1) < 0)
+        return;
+    input->thread.join();
+
+    close(input->stopPipe[0]);
+    close(input->stopPipe[1]);
+    XCloseDisplay(input->display);
+    input->display = NULL;
+}
+
+#endif
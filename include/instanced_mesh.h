@@ -0,0 +1,254 @@
+#ifndef INSTANCED_MESH_H
+#define INSTANCED_MESH_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <vertex_format.h>
+
+// Draws many copies of one indexed mesh, each with its own model matrix.
+// Hardware instancing streams the matrices from an instance VBO with the
+// core GL 3.3 attribute divisor. Without it the mesh is replicated once per
+// batch slot, each copy tagged with its index, and the matrices go through
+// a uniform array with one draw per batch. The batch is as many matrices as
+// the shader's array holds and the vertex uniform vectors left by the
+// program's other uniforms allow, INSTANCE_UNIFORM_BATCH at most.
+//
+// Shaders read the matrix from a mat4 attribute at matrixLocation (which
+// takes 4 locations) when hardware instancing, and from
+// instanceModels[int(aInstance)] otherwise. Like vertex_format.h the GL
+// header is left to the includer.
+
+#define INSTANCE_UNIFORM_BATCH  32
+#define INSTANCE_MATRIX_SIZE    (16 * sizeof(GLfloat))
+
+typedef void (*InstanceDivisorFunc)(GLuint index, GLuint divisor);
+typedef void (*DrawInstancedFunc)(GLenum mode, GLsizei count, GLenum type,
+                                  const void *indices, GLsizei instances);
+
+// Both NULL selects the uniform array fallback
+typedef struct _instancingApi
+{
+    InstanceDivisorFunc vertexAttribDivisor;
+    DrawInstancedFunc drawElementsInstanced;
+} InstancingApi;
+
+typedef struct _instancedMesh
+{
+    InstancingApi api;
+    bool hardware;
+
+    GLuint vbo;
+    GLuint ibo;
+    GLuint instanceVbo;         // matrices, or per-vertex copy indices
+    VertexFormat format;
+    GLsizei numIndices;         // of a single copy
+
+    GLint matrixLocation;
+    GLint instanceLocation;     // aInstance
+    GLint modelsLocation;       // instanceModels
+
+    std::vector<GLfloat> matrices;  // uniform mode uploads them per batch
+    int batch;                      // matrices per uniform mode draw
+    int numInstances;
+} InstancedMesh;
+
+InstancingApi coreInstancingApi()
+{
+    InstancingApi api = { (InstanceDivisorFunc) glVertexAttribDivisor,
+                          (DrawInstancedFunc) glDrawElementsInstanced };
+
+    return api;
+}
+
+// Vector registers taken by a uniform of this type, per array element
+GLint uniformTypeVectors(GLenum type)
+{
+    switch (type) {
+    case GL_FLOAT_MAT2:
+        return 2;
+    case GL_FLOAT_MAT3:
+        return 3;
+    case GL_FLOAT_MAT4:
+        return 4;
+    case GL_FLOAT_MAT2x3:
+    case GL_FLOAT_MAT2x4:
+        return 2;
+    case GL_FLOAT_MAT3x2:
+    case GL_FLOAT_MAT3x4:
+        return 3;
+    case GL_FLOAT_MAT4x2:
+    case GL_FLOAT_MAT4x3:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+// Matrices a uniform mode draw can take. Uniforms of both stages count
+// against the vertex budget, that errs on the safe side.
+int instanceUniformBatch(GLuint program)
+{
+    GLint maxVectors, numUniforms, maxName;
+    GLint used = 0, declared = 0;
+
+    glGetIntegerv(GL_MAX_VERTEX_UNIFORM_COMPONENTS, &maxVectors);
+    maxVectors /= 4;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxName);
+
+    std::vector<GLchar> name(maxName > 0 ? maxName : 1);
+    for (GLint i = 0; i < numUniforms; i++) {
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(program, i, name.size(), NULL, &size, &type, &name[0]);
+
+        // uniform block members live in buffers, not in the budget
+        GLuint index = i;
+        GLint block;
+        glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &block);
+        if (block >= 0)
+            continue;
+        if (strncmp(&name[0], "instanceModels", 14) == 0 &&
+            (name[14] == '\0' || name[14] == '['))
+            declared = size;
+        else
+            used += size * uniformTypeVectors(type);
+    }
+
+    int batch = (maxVectors - used) / 4;
+    if (declared > 0 && batch > declared)
+        batch = declared;
+    if (batch > INSTANCE_UNIFORM_BATCH)
+        batch = INSTANCE_UNIFORM_BATCH;
+    return batch;
+}
+
+// vertices are already encoded in format, whose locations must be resolved
+bool initInstancedMesh(InstancedMesh *mesh, const InstancingApi *api,
+                       const VertexFormat *format, const void *vertices, int numVertices,
+                       const GLushort *indices, int numIndices,
+                       GLuint program, GLint matrixLocation)
+{
+    mesh->api = *api;
+    mesh->hardware = api->drawElementsInstanced != NULL;
+    mesh->format = *format;
+    mesh->numIndices = numIndices;
+    mesh->matrixLocation = matrixLocation;
+    mesh->instanceLocation = glGetAttribLocation(program, "aInstance");
+    mesh->modelsLocation = glGetUniformLocation(program, "instanceModels");
+    mesh->numInstances = 0;
+    mesh->batch = mesh->hardware ? 0 : instanceUniformBatch(program);
+
+    if (!mesh->hardware && mesh->batch < 1) {
+        printf("No uniform space left for instance matrices\n");
+        return false;
+    }
+
+    int copies = mesh->hardware ? 1 : mesh->batch;
+    if (numVertices * copies > 65536) {
+        printf("Mesh too large to replicate for uniform instancing\n");
+        return false;
+    }
+
+    std::vector<unsigned char> data(numVertices * copies * format->stride);
+    std::vector<GLushort> replicated(numIndices * copies);
+    std::vector<GLubyte> copyIndices(numVertices * copies);
+    for (int c = 0; c < copies; c++) {
+        memcpy(&data[c * numVertices * format->stride], vertices,
+               numVertices * format->stride);
+        for (int i = 0; i < numIndices; i++)
+            replicated[c * numIndices + i] = indices[i] + c * numVertices;
+        memset(&copyIndices[c * numVertices], c, numVertices);
+    }
+
+    glGenBuffers(1, &mesh->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+    glBufferData(GL_ARRAY_BUFFER, data.size(), &data[0], GL_STATIC_DRAW);
+
+    glGenBuffers(1, &mesh->ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, replicated.size() * sizeof(GLushort),
+                 &replicated[0], GL_STATIC_DRAW);
+
+    glGenBuffers(1, &mesh->instanceVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->instanceVbo);
+    if (!mesh->hardware)
+        glBufferData(GL_ARRAY_BUFFER, copyIndices.size(), &copyIndices[0], GL_STATIC_DRAW);
+    return true;
+}
+
+// matrices holds count column major 4x4 matrices
+void setInstanceTransforms(InstancedMesh *mesh, const GLfloat *matrices, int count)
+{
+    mesh->numInstances = count;
+
+    if (!mesh->hardware) {
+        mesh->matrices.assign(matrices, matrices + count * 16);
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->instanceVbo);
+    glBufferData(GL_ARRAY_BUFFER, count * INSTANCE_MATRIX_SIZE, matrices, GL_DYNAMIC_DRAW);
+}
+
+// The program must be in use. Attribute state touched here is reset after the
+// draw so meshes drawn without instancing are not affected.
+void drawInstancedMesh(const InstancedMesh *mesh)
+{
+    if (mesh->numInstances == 0)
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+    applyVertexFormat(&mesh->format, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->instanceVbo);
+
+    if (mesh->hardware) {
+        for (int c = 0; c < 4; c++) {
+            GLuint location = mesh->matrixLocation + c;
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, INSTANCE_MATRIX_SIZE,
+                                  (void *) (c * 4 * sizeof(GLfloat)));
+            glEnableVertexAttribArray(location);
+            mesh->api.vertexAttribDivisor(location, 1);
+        }
+
+        mesh->api.drawElementsInstanced(GL_TRIANGLES, mesh->numIndices, GL_UNSIGNED_SHORT,
+                                        (void *) 0, mesh->numInstances);
+
+        for (int c = 0; c < 4; c++) {
+            mesh->api.vertexAttribDivisor(mesh->matrixLocation + c, 0);
+            glDisableVertexAttribArray(mesh->matrixLocation + c);
+        }
+        return;
+    }
+
+    if (mesh->instanceLocation >= 0) {
+        glVertexAttribPointer(mesh->instanceLocation, 1, GL_UNSIGNED_BYTE, GL_FALSE, 0,
+                              (void *) 0);
+        glEnableVertexAttribArray(mesh->instanceLocation);
+    }
+
+    for (int first = 0; first < mesh->numInstances; first += mesh->batch) {
+        int count = mesh->numInstances - first;
+        if (count > mesh->batch)
+            count = mesh->batch;
+
+        glUniformMatrix4fv(mesh->modelsLocation, count, GL_FALSE, &mesh->matrices[first * 16]);
+        glDrawElements(GL_TRIANGLES, count * mesh->numIndices, GL_UNSIGNED_SHORT, (void *) 0);
+    }
+
+    if (mesh->instanceLocation >= 0)
+        glDisableVertexAttribArray(mesh->instanceLocation);
+}
+
+void destroyInstancedMesh(InstancedMesh *mesh)
+{
+    GLuint buffers[] = { mesh->vbo, mesh->ibo, mesh->instanceVbo };
+
+    glDeleteBuffers(3, buffers);
+    mesh->vbo = mesh->ibo = mesh->instanceVbo = 0;
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <new>
+#include <stddef.h>
+#include <stdlib.h>
+#include <vector>
+
+// Pool of T. Objects are carved out of pages allocated a page at a time,
+// and freed objects go on an intrusive free list, so allocating and freeing
+// are O(1) and steady churn never reaches malloc. poolAlloc() value
+// initializes the object (plain structs come out zeroed) and poolFree()
+// destroys it. The live count is the leak accounting, destroyObjectPool()
+// reports what is left.
+
+#define OBJECT_POOL_PAGE_OBJECTS    64
+
+// A free slot holds the link, a used one the object
+template <typename T>
+union ObjectPoolSlot
+{
+    ObjectPoolSlot *next;
+    alignas(T) unsigned char object[sizeof(T)];
+};
+
+template <typename T>
+struct ObjectPool
+{
+    int objectsPerPage;
+    std::vector<ObjectPoolSlot<T> *> pages;
+    ObjectPoolSlot<T> *freeList;
+    int live;
+    int peak;
+};
+
+template <typename T>
+void initObjectPool(ObjectPool<T> *pool, int objectsPerPage)
+{
+    pool->objectsPerPage = objectsPerPage > 0 ? objectsPerPage : OBJECT_POOL_PAGE_OBJECTS;
+    pool->pages.clear();
+    pool->freeList = NULL;
+    pool->live = 0;
+    pool->peak = 0;
+}
+
+// NULL when out of memory
+template <typename T>
+T *poolAlloc(ObjectPool<T> *pool)
+{
+    if (pool->freeList == NULL) {
+        ObjectPoolSlot<T> *page = (ObjectPoolSlot<T> *)
+            malloc(sizeof(ObjectPoolSlot<T>) * pool->objectsPerPage);
+        if (page == NULL)
+            return NULL;
+        pool->pages.push_back(page);
+
+        // thread the new page onto the free list, first object on top
+        for (int i = pool->objectsPerPage - 1; i >= 0; i--) {
+            page[i].next = pool->freeList;
+            pool->freeList = &page[i];
+        }
+    }
+
+    ObjectPoolSlot<T> *slot = pool->freeList;
+    pool->freeList = slot->next;
+
+    if (++pool->live > pool->peak)
+        pool->peak = pool->live;
+
+    return new (slot->object) T();
+}
+
+template <typename T>
+void poolFree(ObjectPool<T> *pool, T *object)
+{
+    if (object == NULL)
+        return;
+
+    object->~T();
+    ObjectPoolSlot<T> *slot = (ObjectPoolSlot<T> *) object;
+    slot->next = pool->freeList;
+    pool->freeList = slot;
+    pool->live--;
+}
+
+// Releases every page, returns how many objects were never freed. Those
+// aren't destroyed.
+template <typename T>
+int destroyObjectPool(ObjectPool<T> *pool)
+{
+    int leaked = pool->live;
+
+    for (ObjectPoolSlot<T> *page : pool->pages)
+        free(page);
+    pool->pages.clear();
+    pool->freeList = NULL;
+    pool->live = 0;
+
+    return leaked;
+}
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Draws are submitted with a 64-bit sort key and an item index, sorted once
+// per frame and replayed through callbacks that only run when the layer,
+// program or texture field of the key changes. Key layout, most significant
+// first:
+//
+//   opaque layers 0-7:       layer:4 | program:8 | texture:20 | depth:32
+//   translucent layers 8-15: layer:4 | ~depth:32 | program:8 | texture:20
+//
+// Opaque draws group by state and go front to back within a group, so the
+// depth test rejects hidden fragments early. Translucent draws must blend
+// back to front, so depth comes first there. Program and texture ids must
+// fit their fields since equal fields are taken to mean equal state.
+
+#define RENDER_LAYER_TRANSLUCENT    8
+#define RENDER_KEY_LAYER_SHIFT      60
+#define RENDER_KEY_PROGRAM_SHIFT    52
+#define RENDER_KEY_TEXTURE_SHIFT    32
+#define RENDER_KEY_DEPTH_SHIFT      28      // translucent layout
+#define RENDER_KEY_PROGRAM_MASK     0xffull
+#define RENDER_KEY_TEXTURE_MASK     0xfffffull
+#define RENDER_DEPTH_LEVELS         65536
+
+typedef struct _renderEntry
+{
+    uint64_t key;
+    uint32_t item;
+} RenderEntry;
+
+typedef struct _renderStats
+{
+    int draws;
+    int programBinds;
+    int textureBinds;
+    int naiveProgramBinds;      // what submission order would have cost
+    int naiveTextureBinds;
+} RenderStats;
+
+typedef struct _renderQueue
+{
+    std::vector<RenderEntry> entries;
+    std::vector<RenderEntry> scratch;
+    RenderStats stats;
+} RenderQueue;
+
+typedef struct _renderCallbacks
+{
+    void (*bindLayer)(void *user, uint32_t layer);
+    void (*bindProgram)(void *user, uint32_t program);
+    void (*bindTexture)(void *user, uint32_t texture);
+    void (*draw)(void *user, uint32_t item);
+    void *user;
+} RenderCallbacks;
+
+// View depth mapped to 0..RENDER_DEPTH_LEVELS-1, nearer is smaller. 16 bits
+// leave the top of the depth field constant, so the sort skips those passes.
+uint32_t quantizeDepth(float depth, float nearPlane, float farPlane)
+{
+    float t = (depth - nearPlane) / (farPlane - nearPlane);
+
+    if (t < 0.0f)
+        t = 0.0f;
+    if (t > 1.0f)
+        t = 1.0f;
+
+    return (uint32_t) (t * (RENDER_DEPTH_LEVELS - 1) + 0.5f);
+}
+
+// depth as returned by quantizeDepth
+uint64_t makeRenderKey(uint32_t layer, uint32_t program, uint32_t texture, uint32_t depth)
+{
+    uint64_t key = (uint64_t) (layer & 0xf) << RENDER_KEY_LAYER_SHIFT;
+
+    if (layer >= RENDER_LAYER_TRANSLUCENT)
+        return key | (uint64_t) (~depth) << RENDER_KEY_DEPTH_SHIFT |
+               (program & RENDER_KEY_PROGRAM_MASK) << (RENDER_KEY_PROGRAM_SHIFT - 32) |
+               (texture & RENDER_KEY_TEXTURE_MASK);
+
+    return key | (program & RENDER_KEY_PROGRAM_MASK) << RENDER_KEY_PROGRAM_SHIFT |
+           (texture & RENDER_KEY_TEXTURE_MASK) << RENDER_KEY_TEXTURE_SHIFT | depth;
+}
+
+uint32_t renderKeyLayer(uint64_t key)
+{
+    return key >> RENDER_KEY_LAYER_SHIFT;
+}
+
+uint32_t renderKeyProgram(uint64_t key)
+{
+    int shift = RENDER_KEY_PROGRAM_SHIFT;
+    if (renderKeyLayer(key) >= RENDER_LAYER_TRANSLUCENT)
+        shift -= 32;
+
+    return (key >> shift) & RENDER_KEY_PROGRAM_MASK;
+}
+
+uint32_t renderKeyTexture(uint64_t key)
+{
+    int shift = RENDER_KEY_TEXTURE_SHIFT;
+    if (renderKeyLayer(key) >= RENDER_LAYER_TRANSLUCENT)
+        shift -= 32;
+
+    return (key >> shift) & RENDER_KEY_TEXTURE_MASK;
+}
+
+void beginRenderQueue(RenderQueue *queue)
+{
+    queue->entries.clear();
+    memset(&queue->stats, 0, sizeof(RenderStats));
+}
+
+void submitDraw(RenderQueue *queue, uint64_t key, uint32_t item)
+{
+    RenderEntry entry = { key, item };
+
+    if (queue->entries.empty() ||
+        renderKeyProgram(queue->entries.back().key) != renderKeyProgram(key))
+        queue->stats.naiveProgramBinds++;
+    if (queue->entries.empty() ||
+        renderKeyTexture(queue->entries.back().key) != renderKeyTexture(key))
+        queue->stats.naiveTextureBinds++;
+
+    queue->entries.push_back(entry);
+}
+
+// LSD radix sort, 8 bits per pass. Stable, and passes where every key has
+// the same digit are skipped, so a queue using few layers or programs
+// costs only the passes its keys actually vary in.
+void sortRenderQueue(RenderQueue *queue)
+{
+    size_t count = queue->entries.size();
+    if (count < 2)
+        return;
+
+    queue->scratch.resize(count);
+    RenderEntry *src = &queue->entries[0];
+    RenderEntry *dst = &queue->scratch[0];
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t offsets[256] = { 0 };
+        for (size_t i = 0; i < count; i++)
+            offsets[(src[i].key >> shift) & 0xff]++;
+
+        if (offsets[(src[0].key >> shift) & 0xff] == count)
+            continue;
+
+        size_t total = 0;
+        for (int d = 0; d < 256; d++) {
+            size_t n = offsets[d];
+            offsets[d] = total;
+            total += n;
+        }
+
+        for (size_t i = 0; i < count; i++)
+            dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+
+        RenderEntry *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != &queue->entries[0])
+        memcpy(&queue->entries[0], src, count * sizeof(RenderEntry));
+}
+
+// Entries [begin, end) of a sorted queue. The first one binds all of its
+// state, so separate ranges can be replayed by independent recorders; the
+// queue itself is only read and the counts go to stats.
+void executeRenderRange(const RenderQueue *queue, size_t begin, size_t end,
+                        const RenderCallbacks *callbacks, RenderStats *stats)
+{
+    for (size_t i = begin; i < end; i++) {
+        uint64_t key = queue->entries[i].key;
+        uint64_t previous = i > begin ? queue->entries[i - 1].key : 0;
+
+        if (i == begin || renderKeyLayer(previous) != renderKeyLayer(key)) {
+            if (callbacks->bindLayer != NULL)
+                callbacks->bindLayer(callbacks->user, renderKeyLayer(key));
+        }
+        if (i == begin || renderKeyProgram(previous) != renderKeyProgram(key)) {
+            if (callbacks->bindProgram != NULL)
+                callbacks->bindProgram(callbacks->user, renderKeyProgram(key));
+            stats->programBinds++;
+        }
+        if (i == begin || renderKeyTexture(previous) != renderKeyTexture(key)) {
+            if (callbacks->bindTexture != NULL)
+                callbacks->bindTexture(callbacks->user, renderKeyTexture(key));
+            stats->textureBinds++;
+        }
+
+        callbacks->draw(callbacks->user, queue->entries[i].item);
+        stats->draws++;
+    }
+}
+
+void executeRenderQueue(RenderQueue *queue, const RenderCallbacks *callbacks)
+{
+    executeRenderRange(queue, 0, queue->entries.size(), callbacks, &queue->stats);
+}
+
+#endif
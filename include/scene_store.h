@@ -0,0 +1,122 @@
+#ifndef SCENE_STORE_H
+#define SCENE_STORE_H
+
+#include <stdint.h>
+#include <vector>
+
+// Structure of arrays storage for drawable items. Every field lives in its
+// own dense array indexed 0..count-1, so per-frame passes stream through
+// just the fields they touch. Items are referred to by generational handles:
+// destroying an item moves the last one into its place and bumps the slot's
+// generation, so stale handles are detected instead of aliasing a new item.
+
+typedef struct _sceneHandle
+{
+    uint32_t slot;
+    uint32_t generation;        // 0 is never issued, a zeroed handle is invalid
+} SceneHandle;
+
+typedef struct _sceneStore
+{
+    // dense, one entry per live item
+    std::vector<float> positions;       // x, y, z
+    std::vector<float> scales;
+    std::vector<float> depths;          // view depth, written by the cull pass
+    std::vector<float> bounds;          // x0, y0, x1, y1 window pixels, likewise
+    std::vector<uint8_t> opacities;     // 255 is opaque
+    std::vector<uint32_t> textures;
+    std::vector<uint16_t> programs;     // index into the owner's program table
+    std::vector<uint8_t> visible;
+    std::vector<uint32_t> slotOf;
+
+    // sparse, one entry per slot ever handed out
+    std::vector<uint32_t> denseOf;
+    std::vector<uint32_t> generations;
+    std::vector<uint32_t> freeSlots;
+} SceneStore;
+
+int sceneItemCount(const SceneStore *store)
+{
+    return (int) store->slotOf.size();
+}
+
+// Dense index of a live item, -1 for a stale or invalid handle
+int sceneItemIndex(const SceneStore *store, SceneHandle handle)
+{
+    if (handle.slot >= store->generations.size() ||
+        store->generations[handle.slot] != handle.generation)
+        return -1;
+
+    return (int) store->denseOf[handle.slot];
+}
+
+SceneHandle createSceneItem(SceneStore *store)
+{
+    uint32_t slot;
+
+    if (!store->freeSlots.empty()) {
+        slot = store->freeSlots.back();
+        store->freeSlots.pop_back();
+    } else {
+        slot = store->generations.size();
+        store->generations.push_back(1);
+        store->denseOf.push_back(0);
+    }
+
+    store->denseOf[slot] = store->slotOf.size();
+    store->slotOf.push_back(slot);
+    store->positions.insert(store->positions.end(), 3, 0.0f);
+    store->scales.push_back(1.0f);
+    store->depths.push_back(0.0f);
+    store->bounds.insert(store->bounds.end(), 4, 0.0f);
+    store->opacities.push_back(255);
+    store->textures.push_back(0);
+    store->programs.push_back(0);
+    store->visible.push_back(1);
+
+    SceneHandle handle = { slot, store->generations[slot] };
+    return handle;
+}
+
+bool destroySceneItem(SceneStore *store, SceneHandle handle)
+{
+    int index = sceneItemIndex(store, handle);
+    if (index < 0)
+        return false;
+
+    // fill the hole with the last item to keep the arrays dense
+    int last = sceneItemCount(store) - 1;
+    if (index != last) {
+        for (int c = 0; c < 3; c++)
+            store->positions[index * 3 + c] = store->positions[last * 3 + c];
+        store->scales[index] = store->scales[last];
+        store->depths[index] = store->depths[last];
+        for (int c = 0; c < 4; c++)
+            store->bounds[index * 4 + c] = store->bounds[last * 4 + c];
+        store->opacities[index] = store->opacities[last];
+        store->textures[index] = store->textures[last];
+        store->programs[index] = store->programs[last];
+        store->visible[index] = store->visible[last];
+        store->slotOf[index] = store->slotOf[last];
+        store->denseOf[store->slotOf[index]] = index;
+    }
+
+    store->positions.resize(last * 3);
+    store->scales.pop_back();
+    store->depths.pop_back();
+    store->bounds.resize(last * 4);
+    store->opacities.pop_back();
+    store->textures.pop_back();
+    store->programs.pop_back();
+    store->visible.pop_back();
+    store->slotOf.pop_back();
+
+    // skip 0 on wrap so zeroed handles stay invalid
+    if (++store->generations[handle.slot] == 0)
+        store->generations[handle.slot] = 1;
+    store->freeSlots.push_back(handle.slot);
+
+    return true;
+}
+
+#endif
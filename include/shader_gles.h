@@ -8,6 +8,8 @@
 #include <sstream>
 #include <iostream>
 
+#include <gl_state_gles.h>
+
 class Shader
 {
 public:
@@ -83,7 +85,7 @@ public:
     // use/activate the shader
     void use()
     {
-        glUseProgram(ID);
+        cacheUseProgram(ID);
     }
 
     unsigned int get_id()
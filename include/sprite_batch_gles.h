@@ -0,0 +1,158 @@
+#ifndef SPRITE_BATCH_GLES_H
+#define SPRITE_BATCH_GLES_H
+
+#include <GLES2/gl2.h>
+
+#include <vector>
+
+#include <buffer_gles.h>
+
+// Accumulates textured quads and draws each run of quads sharing a texture
+// with a single glDrawElements. Vertices stream into a dynamic VBO used as a
+// ring: every flush appends after the previous one with glBufferSubData, so
+// the GPU can still be reading earlier regions, and the buffer is orphaned
+// with glBufferData(NULL) only when the ring wraps.
+
+#define SPRITE_BATCH_MAX_QUADS      4096    // per draw, keeps indices 16-bit
+#define SPRITE_BATCH_RING_QUADS     (4 * SPRITE_BATCH_MAX_QUADS)
+
+typedef struct _spriteVertex
+{
+    GLfloat position[3];
+    GLushort texCoord[2];
+    GLubyte color[4];
+} SpriteVertex;
+
+typedef struct _spriteBatch
+{
+    GLuint vbo;
+    GLuint ibo;
+    VertexFormat format;
+    VertexArray array;
+
+    std::vector<SpriteVertex> vertices;     // quads waiting for the next flush
+    GLuint texture;
+    int ringQuad;                           // next free quad in the VBO
+
+    // per frame counters, reset by beginSpriteBatch
+    int sprites;
+    int drawCalls;
+    int orphans;
+} SpriteBatch;
+
+void initSpriteBatch(SpriteBatch *batch, BufferManager *manager, GLuint program)
+{
+    std::vector<GLushort> indices(SPRITE_BATCH_MAX_QUADS * 6);
+    for (int i = 0; i < SPRITE_BATCH_MAX_QUADS; i++) {
+        GLushort quad[] = { 0, 1, 3, 1, 2, 3 };
+        for (int j = 0; j < 6; j++)
+            indices[i * 6 + j] = i * 4 + quad[j];
+    }
+
+    batch->format = VertexFormat();
+    addVertexElement(&batch->format, "v_position", -1, 3, GL_FLOAT, GL_FALSE);
+    addVertexElement(&batch->format, "a_texCoord", -1, 2, GL_UNSIGNED_SHORT, GL_TRUE);
+    addVertexElement(&batch->format, "a_color", -1, 4, GL_UNSIGNED_BYTE, GL_TRUE);
+    resolveVertexFormat(&batch->format, program);
+
+    batch->vbo = createBuffer(manager, GL_ARRAY_BUFFER,
+                              SPRITE_BATCH_RING_QUADS * 4 * sizeof(SpriteVertex),
+                              NULL, GL_STREAM_DRAW);
+    batch->ibo = createBuffer(manager, GL_ELEMENT_ARRAY_BUFFER,
+                              indices.size() * sizeof(GLushort), &indices[0],
+                              GL_STATIC_DRAW);
+
+    createVertexArray(&batch->array);
+    setVertexArrayElements(&batch->array, batch->ibo);
+    bindVertexArray(NULL);
+
+    batch->vertices.reserve(SPRITE_BATCH_MAX_QUADS * 4);
+    batch->texture = 0;
+    batch->ringQuad = 0;
+    batch->sprites = 0;
+    batch->drawCalls = 0;
+    batch->orphans = 0;
+}
+
+void flushSpriteBatch(SpriteBatch *batch)
+{
+    int numQuads = batch->vertices.size() / 4;
+    if (numQuads == 0)
+        return;
+
+    cacheBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+    if (batch->ringQuad + numQuads > SPRITE_BATCH_RING_QUADS) {
+        glBufferData(GL_ARRAY_BUFFER, SPRITE_BATCH_RING_QUADS * 4 * sizeof(SpriteVertex),
+                     NULL, GL_STREAM_DRAW);
+        batch->ringQuad = 0;
+        batch->orphans++;
+    }
+
+    GLintptr base = batch->ringQuad * 4 * sizeof(SpriteVertex);
+    glBufferSubData(GL_ARRAY_BUFFER, base, numQuads * 4 * sizeof(SpriteVertex),
+                    &batch->vertices[0]);
+    batch->ringQuad += numQuads;
+
+    // only the base moves between flushes
+    setVertexArrayFormat(&batch->array, &batch->format, batch->vbo, base);
+    bindVertexArray(&batch->array);
+
+    cacheActiveTexture(GL_TEXTURE0);
+    cacheBindTexture(batch->texture);
+
+    glDrawElements(GL_TRIANGLES, numQuads * 6, GL_UNSIGNED_SHORT, (void *) 0);
+    batch->drawCalls++;
+    batch->vertices.clear();
+}
+
+void beginSpriteBatch(SpriteBatch *batch)
+{
+    batch->vertices.clear();
+    batch->sprites = 0;
+    batch->drawCalls = 0;
+    batch->orphans = 0;
+}
+
+// Queues an axis aligned quad centered on position. uv is the texture
+// rectangle as s0, t0, s1, t1.
+void drawSprite(SpriteBatch *batch, GLuint texture, const GLfloat position[3],
+                GLfloat width, GLfloat height, const GLfloat uv[4], const GLubyte color[4])
+{
+    if (texture != batch->texture || batch->vertices.size() == SPRITE_BATCH_MAX_QUADS * 4) {
+        flushSpriteBatch(batch);
+        batch->texture = texture;
+    }
+
+    // same corner order as generateRect: top left, top right, bottom right, bottom left
+    const GLfloat corners[4][2] = { { -0.5f, 0.5f }, { 0.5f, 0.5f },
+                                    { 0.5f, -0.5f }, { -0.5f, -0.5f } };
+    const int cornerUv[4][2] = { { 0, 1 }, { 2, 1 }, { 2, 3 }, { 0, 3 } };
+
+    for (int i = 0; i < 4; i++) {
+        SpriteVertex vertex;
+
+        vertex.position[0] = position[0] + corners[i][0] * width;
+        vertex.position[1] = position[1] + corners[i][1] * height;
+        vertex.position[2] = position[2];
+        vertex.texCoord[0] = (GLushort) (uv[cornerUv[i][0]] * 65535.0f + 0.5f);
+        vertex.texCoord[1] = (GLushort) (uv[cornerUv[i][1]] * 65535.0f + 0.5f);
+        memcpy(vertex.color, color, sizeof(vertex.color));
+
+        batch->vertices.push_back(vertex);
+    }
+
+    batch->sprites++;
+}
+
+void endSpriteBatch(SpriteBatch *batch)
+{
+    flushSpriteBatch(batch);
+}
+
+// The buffers belong to the BufferManager passed to initSpriteBatch
+void destroySpriteBatch(SpriteBatch *batch)
+{
+    destroyVertexArray(&batch->array);
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Lock-free handoff of whole frames from one producer thread to one
+// consumer thread. The caller owns three slots of data and this only tracks
+// which is which: the producer fills its write slot and publishes it, the
+// consumer acquires the latest published slot and reads it for as long as it
+// likes. Neither side ever waits for the other; frames published faster than
+// they are consumed are simply dropped.
+
+#define TRIPLE_BUFFER_FRESH 4   // set on middle when it holds an unread slot
+#define TRIPLE_BUFFER_SLOT  3
+
+typedef struct _tripleBuffer
+{
+    unsigned writing;               // producer only
+    std::atomic<unsigned> middle;   // the handoff slot, plus TRIPLE_BUFFER_FRESH
+    unsigned reading;               // consumer only
+} TripleBuffer;
+
+void initTripleBuffer(TripleBuffer *buffer)
+{
+    buffer->writing = 0;
+    buffer->middle.store(1);
+    buffer->reading = 2;
+}
+
+// Slot the producer may write, 0..2
+unsigned tripleBufferWriteSlot(const TripleBuffer *buffer)
+{
+    return buffer->writing;
+}
+
+// Hands the write slot over and takes the middle one to write next
+void publishTripleBuffer(TripleBuffer *buffer)
+{
+    unsigned previous = buffer->middle.exchange(buffer->writing | TRIPLE_BUFFER_FRESH,
+                                                std::memory_order_acq_rel);
+    buffer->writing = previous & TRIPLE_BUFFER_SLOT;
+}
+
+// Swaps in the latest published slot, false (keeping the current one) when
+// nothing was published since the last call
+bool acquireTripleBuffer(TripleBuffer *buffer)
+{
+    if ((buffer->middle.load(std::memory_order_relaxed) & TRIPLE_BUFFER_FRESH) == 0)
+        return false;
+
+    unsigned previous = buffer->middle.exchange(buffer->reading, std::memory_order_acq_rel);
+    buffer->reading = previous & TRIPLE_BUFFER_SLOT;
+    return true;
+}
+
+// Slot the consumer may read, 0..2
+unsigned tripleBufferReadSlot(const TripleBuffer *buffer)
+{
+    return buffer->reading;
+}
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef VERTEX_ARRAY_GLES_H
+#define VERTEX_ARRAY_GLES_H
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vertex_format.h>
+#include <gl_state_gles.h>
+#include <extension_gles.h>
+
+// Vertex array objects for GLES2. With OES_vertex_array_object each
+// VertexArray is a real VAO and drawing costs one bind. Without it the
+// attribute state is recorded on the CPU and binding only issues the
+// pointer, enable and disable calls that differ from what GL already has.
+// VERTEX_ARRAY_EMULATION=1 forces the CPU path.
+//
+// Raw attribute calls made while a native VAO is bound would change that
+// VAO, so code outside this layer binds NULL first and calls
+// invalidateVertexArrayState() when done.
+
+#define VERTEX_ARRAY_MAX_ATTRIBS 16
+
+typedef struct _vertexAttribState
+{
+    bool enabled;
+    GLuint buffer;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei stride;
+    GLintptr offset;
+} VertexAttribState;
+
+typedef struct _vertexArray
+{
+    GLuint vao;                 // 0 when emulated
+    GLuint elementBuffer;
+    VertexAttribState attribs[VERTEX_ARRAY_MAX_ATTRIBS];
+} VertexArray;
+
+typedef struct _vertexArrayState
+{
+    bool initialized;
+    bool native;
+    PFNGLGENVERTEXARRAYSOESPROC genVertexArrays;
+    PFNGLBINDVERTEXARRAYOESPROC bindVertexArray;
+    PFNGLDELETEVERTEXARRAYSOESPROC deleteVertexArrays;
+
+    GLuint boundVao;
+    VertexArray current;        // emulation: the attribute state GL has now
+    bool dirty;                 // current can't be trusted
+} VertexArrayState;
+
+static VertexArrayState vertexArrayState;
+
+// Runs on first use, a context must be current
+void initVertexArrays()
+{
+    VertexArrayState *state = &vertexArrayState;
+    const char *emulation = getenv("VERTEX_ARRAY_EMULATION");
+
+    memset(state, 0, sizeof(VertexArrayState));
+    state->initialized = true;
+    state->dirty = true;
+
+    if ((emulation != NULL && atoi(emulation) != 0) ||
+        !hasExtension("GL_OES_vertex_array_object"))
+        return;
+
+    state->genVertexArrays = (PFNGLGENVERTEXARRAYSOESPROC)
+        eglGetProcAddress("glGenVertexArraysOES");
+    state->bindVertexArray = (PFNGLBINDVERTEXARRAYOESPROC)
+        eglGetProcAddress("glBindVertexArrayOES");
+    state->deleteVertexArrays = (PFNGLDELETEVERTEXARRAYSOESPROC)
+        eglGetProcAddress("glDeleteVertexArraysOES");
+    state->native = state->genVertexArrays != NULL && state->bindVertexArray != NULL &&
+                    state->deleteVertexArrays != NULL;
+}
+
+void createVertexArray(VertexArray *array)
+{
+    if (!vertexArrayState.initialized)
+        initVertexArrays();
+
+    memset(array, 0, sizeof(VertexArray));
+    if (vertexArrayState.native)
+        vertexArrayState.genVertexArrays(1, &array->vao);
+}
+
+// GL changed behind the layer's back, the next emulated bind resends everything
+void invalidateVertexArrayState()
+{
+    vertexArrayState.dirty = true;
+}
+
+bool sameAttribPointer(const VertexAttribState *a, const VertexAttribState *b)
+{
+    return a->buffer == b->buffer && a->size == b->size && a->type == b->type &&
+           a->normalized == b->normalized && a->stride == b->stride &&
+           a->offset == b->offset;
+}
+
+void setAttribPointer(GLuint location, const VertexAttribState *attrib)
+{
+    cacheBindBuffer(GL_ARRAY_BUFFER, attrib->buffer);
+    glVertexAttribPointer(location, attrib->size, attrib->type, attrib->normalized,
+                          attrib->stride, (void *) attrib->offset);
+}
+
+// NULL unbinds, so raw attribute and element buffer calls are safe again
+void bindVertexArray(const VertexArray *array)
+{
+    VertexArrayState *state = &vertexArrayState;
+
+    if (state->native) {
+        GLuint vao = array != NULL ? array->vao : 0;
+        if (state->boundVao != vao)
+            state->bindVertexArray(vao);
+        state->boundVao = vao;
+        return;
+    }
+
+    if (array == NULL)
+        return;
+
+    // emulated: apply the difference, even when rebinding the same array
+    VertexArray *current = &state->current;
+    for (GLuint i = 0; i < VERTEX_ARRAY_MAX_ATTRIBS; i++) {
+        const VertexAttribState *want = &array->attribs[i];
+        VertexAttribState *have = &current->attribs[i];
+
+        if (want->enabled) {
+            if (state->dirty || !sameAttribPointer(want, have))
+                setAttribPointer(i, want);
+            if (state->dirty || !have->enabled)
+                glEnableVertexAttribArray(i);
+            *have = *want;
+        } else if (state->dirty || have->enabled) {
+            glDisableVertexAttribArray(i);
+            have->enabled = false;
+        }
+    }
+
+    if (state->dirty || current->elementBuffer != array->elementBuffer) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, array->elementBuffer);
+        current->elementBuffer = array->elementBuffer;
+    }
+    state->dirty = false;
+}
+
+// Records an enabled attribute sourced from buffer, offset is in bytes
+void setVertexArrayAttrib(VertexArray *array, GLint location, GLuint buffer, GLint size,
+                          GLenum type, GLboolean normalized, GLsizei stride, GLintptr offset)
+{
+    if (location < 0 || location >= VERTEX_ARRAY_MAX_ATTRIBS)
+        return;
+
+    VertexAttribState attrib = { true, buffer, size, type, normalized, stride, offset };
+    VertexAttribState *recorded = &array->attribs[location];
+    if (recorded->enabled && sameAttribPointer(recorded, &attrib))
+        return;
+
+    if (vertexArrayState.native) {
+        bindVertexArray(array);
+        setAttribPointer(location, &attrib);
+        if (!recorded->enabled)
+            glEnableVertexAttribArray(location);
+    }
+    *recorded = attrib;
+}
+
+// Element buffer binding outside any vertex array, e.g. to upload indices
+void bindElementBuffer(GLuint buffer)
+{
+    bindVertexArray(NULL);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    vertexArrayState.current.elementBuffer = buffer;
+}
+
+void setVertexArrayElements(VertexArray *array, GLuint buffer)
+{
+    if (vertexArrayState.native) {
+        bindVertexArray(array);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    }
+    array->elementBuffer = buffer;
+}
+
+// Every element of a resolved format, read from buffer starting at base
+void setVertexArrayFormat(VertexArray *array, const VertexFormat *format,
+                          GLuint buffer, GLintptr base)
+{
+    for (int i = 0; i < format->numElements; i++) {
+        const VertexElement *element = &format->elements[i];
+        setVertexArrayAttrib(array, element->location, buffer, element->size, element->type,
+                             element->normalized, format->stride, base + element->offset);
+    }
+}
+
+void destroyVertexArray(VertexArray *array)
+{
+    if (array->vao == 0)
+        return;
+
+    if (vertexArrayState.boundVao == array->vao)
+        bindVertexArray(NULL);
+    vertexArrayState.deleteVertexArrays(1, &array->vao);
+    array->vao = 0;
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// Describes an interleaved vertex layout and encodes float vertex data into
+// it. Shared by the GL 3.3 and GLES2 samples, so the GL header is left to the
+// includer: GLES2 code needs <GLES2/gl2ext.h> for GL_HALF_FLOAT_OES.
+
+#if defined(GL_HALF_FLOAT_OES)
+#define VERTEX_HALF_FLOAT GL_HALF_FLOAT_OES
+#else
+#define VERTEX_HALF_FLOAT GL_HALF_FLOAT
+#endif
+
+#define VERTEX_FORMAT_MAX_ELEMENTS 8
+
+typedef struct _vertexElement
+{
+    const char *name;       // shader attribute, resolved when location < 0
+    GLint location;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei offset;
+} VertexElement;
+
+typedef struct _vertexFormat
+{
+    VertexElement elements[VERTEX_FORMAT_MAX_ELEMENTS];
+    int numElements = 0;
+    GLsizei stride = 0;
+} VertexFormat;
+
+GLsizei vertexTypeSize(GLenum type)
+{
+    switch (type) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+        return 1;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+    case VERTEX_HALF_FLOAT:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+// Elements are aligned to their component size and the stride to 4 bytes
+void addVertexElement(VertexFormat *format, const char *name, GLint location,
+                      GLint size, GLenum type, GLboolean normalized)
+{
+    if (format->numElements == VERTEX_FORMAT_MAX_ELEMENTS)
+        return;
+
+    GLsizei typeSize = vertexTypeSize(type);
+    GLsizei end = 0;
+    if (format->numElements > 0) {
+        const VertexElement *last = &format->elements[format->numElements - 1];
+        end = last->offset + last->size * vertexTypeSize(last->type);
+    }
+
+    VertexElement *element = &format->elements[format->numElements++];
+    element->name = name;
+    element->location = location;
+    element->size = size;
+    element->type = type;
+    element->normalized = normalized;
+    element->offset = (end + typeSize - 1) / typeSize * typeSize;
+
+    end = element->offset + size * typeSize;
+    format->stride = (end + 3) / 4 * 4;
+}
+
+void resolveVertexFormat(VertexFormat *format, GLuint program)
+{
+    for (int i = 0; i < format->numElements; i++) {
+        VertexElement *element = &format->elements[i];
+        if (element->location < 0 && element->name != NULL)
+            element->location = glGetAttribLocation(program, element->name);
+    }
+}
+
+// Points every element at a buffer bound to GL_ARRAY_BUFFER, from base on
+void applyVertexFormat(const VertexFormat *format, GLintptr base)
+{
+    for (int i = 0; i < format->numElements; i++) {
+        const VertexElement *element = &format->elements[i];
+        if (element->location < 0)
+            continue;
+
+        glVertexAttribPointer(element->location, element->size, element->type,
+                              element->normalized, format->stride,
+                              (void *) (base + element->offset));
+        glEnableVertexAttribArray(element->location);
+    }
+}
+
+uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t) ((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff)          // inf and nan
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 0x1f)                       // too large, clamp to inf
+        return sign | 0x7c00;
+    if (exponent <= 0) {                        // denormal or zero
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        uint32_t shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+        if (rest > midpoint || (rest == midpoint && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    // round to nearest even, a carry into the exponent is still correct
+    uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+
+    return half;
+}
+
+float clampUnit(float value, float low)
+{
+    return value < low ? low : (value > 1.0f ? 1.0f : value);
+}
+
+void encodeVertexComponent(GLenum type, GLboolean normalized, float value,
+                           unsigned char *dst)
+{
+    switch (type) {
+    case GL_BYTE: {
+        int8_t v = normalized ? (int8_t) lroundf(clampUnit(value, -1.0f) * 127.0f)
+                              : (int8_t) lroundf(value);
+        memcpy(dst, &v, sizeof(v));
+        break;
+    }
+    case GL_UNSIGNED_BYTE: {
+        uint8_t v = normalized ? (uint8_t) lroundf(clampUnit(value, 0.0f) * 255.0f)
+                               : (uint8_t) lroundf(value);
+        memcpy(dst, &v, sizeof(v));
+        break;
+    }
+    case GL_SHORT: {
+        int16_t v = normalized ? (int16_t) lroundf(clampUnit(value, -1.0f) * 32767.0f)
+                               : (int16_t) lroundf(value);
+        memcpy(dst, &v, sizeof(v));
+        break;
+    }
+    case GL_UNSIGNED_SHORT: {
+        uint16_t v = normalized ? (uint16_t) lroundf(clampUnit(value, 0.0f) * 65535.0f)
+                                : (uint16_t) lroundf(value);
+        memcpy(dst, &v, sizeof(v));
+        break;
+    }
+    case VERTEX_HALF_FLOAT: {
+        uint16_t v = floatToHalf(value);
+        memcpy(dst, &v, sizeof(v));
+        break;
+    }
+    default:
+        memcpy(dst, &value, sizeof(value));
+        break;
+    }
+}
+
+// src holds, per vertex, each element's components as floats in element
+// order (e.g. x, y, z, s, t); dst receives numVertices * stride bytes
+void encodeVertices(const VertexFormat *format, const float *src, int numVertices,
+                    void *dst)
+{
+    unsigned char *out = (unsigned char *) dst;
+
+    memset(out, 0, numVertices * format->stride);
+    for (int v = 0; v < numVertices; v++) {
+        unsigned char *vertex = out + v * format->stride;
+
+        for (int i = 0; i < format->numElements; i++) {
+            const VertexElement *element = &format->elements[i];
+            GLsizei typeSize = vertexTypeSize(element->type);
+
+            for (int c = 0; c < element->size; c++)
+                encodeVertexComponent(element->type, element->normalized, *src++,
+                                      vertex + element->offset + c * typeSize);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef WINDOW_GLFW_H
+#define WINDOW_GLFW_H
+
+#include <GLFW/glfw3.h>
+
+// Makes the window's context current for the GLFW samples, with swaps
+// waiting for the display's vertical blank (interval 1). That caps the
+// animated loops, which draw every iteration, at the refresh rate instead
+// of spinning a core on frames that are never shown and tearing the ones
+// that are. The static ones block in glfwWaitEvents() between frames. The
+// GLES samples get the same through initFrameScheduler().
+void makeWindowCurrent(GLFWwindow *window)
+{
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(1);
+}
+
+#endif
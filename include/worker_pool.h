@@ -0,0 +1,139 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads for per-frame parallel loops. runWorkerJobs()
+// publishes a batch, hands out its job indices from the batch's own atomic
+// counter, helps with them on the calling thread and returns once every job
+// has finished, so the caller can treat it like a plain loop. The batch is
+// withdrawn only after every worker that took it has left it, so a worker
+// waking late never sees the indices of the next one. Workers sleep between
+// batches.
+
+typedef void (*WorkerJob)(void *user, int index);
+
+// Lives on the stack of runWorkerJobs()
+typedef struct _workerBatch
+{
+    WorkerJob job;
+    void *user;
+    int count;
+    std::atomic<int> next;
+    int pending;                        // jobs not finished yet
+    unsigned generation;
+} WorkerBatch;
+
+typedef struct _workerPool
+{
+    std::vector<std::thread> threads;
+    std::mutex mutex;                   // guards everything but batch->next
+    std::condition_variable start;
+    std::condition_variable done;
+    WorkerBatch *batch;                 // NULL between batches
+    int active;                         // threads inside the current batch
+    unsigned generation;
+    bool stopping;
+} WorkerPool;
+
+void runWorkerBatch(WorkerPool *pool, WorkerBatch *batch)
+{
+    int finished = 0;
+
+    for (int index = batch->next.fetch_add(1); index < batch->count;
+         index = batch->next.fetch_add(1)) {
+        batch->job(batch->user, index);
+        finished++;
+    }
+
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    batch->pending -= finished;
+    pool->active--;
+    if (batch->pending == 0 && pool->active == 0)
+        pool->done.notify_all();
+}
+
+void workerMain(WorkerPool *pool)
+{
+    unsigned seen = 0;
+    std::unique_lock<std::mutex> lock(pool->mutex);
+
+    for (;;) {
+        while (!pool->stopping && (pool->batch == NULL || pool->batch->generation == seen))
+            pool->start.wait(lock);
+        if (pool->stopping)
+            return;
+
+        // joined under the lock: the batch stays until active drops to 0
+        WorkerBatch *batch = pool->batch;
+        seen = batch->generation;
+        pool->active++;
+
+        lock.unlock();
+        runWorkerBatch(pool, batch);
+        lock.lock();
+    }
+}
+
+// numThreads 0 runs every job on the calling thread
+void initWorkerPool(WorkerPool *pool, int numThreads)
+{
+    pool->batch = NULL;
+    pool->active = 0;
+    pool->generation = 0;
+    pool->stopping = false;
+
+    for (int i = 0; i < numThreads; i++)
+        pool->threads.push_back(std::thread(workerMain, pool));
+}
+
+void runWorkerJobs(WorkerPool *pool, int count, WorkerJob job, void *user)
+{
+    // not worth waking anybody
+    if (count <= 1 || pool->threads.empty()) {
+        for (int i = 0; i < count; i++)
+            job(user, i);
+        return;
+    }
+
+    WorkerBatch batch;
+    batch.job = job;
+    batch.user = user;
+    batch.count = count;
+    batch.next.store(0);
+    batch.pending = count;
+
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    batch.generation = ++pool->generation;
+    pool->batch = &batch;
+    pool->active++;
+    pool->start.notify_all();
+    lock.unlock();
+
+    runWorkerBatch(pool, &batch);
+
+    // every job done and every worker out of the batch before it goes away
+    lock.lock();
+    while (batch.pending > 0 || pool->active > 0)
+        pool->done.wait(lock);
+    pool->batch = NULL;
+}
+
+void destroyWorkerPool(WorkerPool *pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->stopping = true;
+        pool->start.notify_all();
+    }
+
+    for (std::thread &thread : pool->threads)
+        thread.join();
+    pool->threads.clear();
+}
+
+#endif
@@ -2,6 +2,8 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <window_glfw.h>
+
 const GLuint WIDTH = 800, HEIGHT = 600;
 
 void processInput(GLFWwindow *window, int key, int scancode, int action, int mode)
@@ -46,7 +48,7 @@ int main()
         glfwTerminate();
         return -1;
     }
-    glfwMakeContextCurrent(window);
+    makeWindowCurrent(window);
 
     glfwSetKeyCallback(window, processInput);
 
@@ -145,9 +147,10 @@ int main()
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
         glBindVertexArray(0);
 
-        // Swap back buffer to front, and check events
+        // Swap back buffer to front, then wait for events: the triangle
+        // never moves, only a resize or expose needs a new frame
         glfwSwapBuffers(window);
-        glfwPollEvents();
+        glfwWaitEvents();
     }
 
     glfwTerminate();
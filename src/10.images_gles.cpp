@@ -7,10 +7,12 @@
 #include <fstream>
 #include <sstream>
 
-#include <SDL.h>
-#include <SDL_image.h>
-
 #include <shader_gles.h>
+#include <buffer_gles.h>
+#include <frame_scheduler.h>
+#include <headless_egl.h>
+#include <golden_image.h>
+#include <image_cache.h>
 #include <matrix_gles.h>
 
 #define ES_WINDOW_RGB           0
@@ -19,14 +21,6 @@
 #define ES_WINDOW_STENCIL       4
 #define ES_WINDOW_MULTISAMPLE   8
 
-#define VERTEX_POS_SIZE         3
-#define VERTEX_NORMAL_SIZE      3
-#define VERTEX_TEXCOORD0_SIZE   2
-
-#define VERTEX_POS_INDX         0
-#define VERTEX_NORMAL_INDX      1
-#define VERTEX_TEXCOORD0_INDX   2
-
 typedef struct _context
 {
     GLuint programObject;
@@ -40,9 +34,8 @@ typedef struct _context
     GLint mvpLoc;
     Matrix mvpMatrix;
 
-    GLfloat *vertices;
-    GLuint *indices;
-    int numIndices;
+    BufferManager buffers;
+    Mesh rect;
 
     GLint width = 1280;
     GLint height = 720;
@@ -53,6 +46,8 @@ typedef struct _context
     EGLContext  eglContext;
     EGLSurface  eglSurface;
 
+    FrameScheduler scheduler;
+
 } Context;
 
 
@@ -61,42 +56,50 @@ GLuint createTexture(const char *img_file)
     GLuint textureId;
 
     glGenTextures(1, &textureId);
-    glBindTexture(GL_TEXTURE_2D, textureId);
+    cacheBindTexture(textureId);
 
-    SDL_Surface* img_surface = IMG_Load(img_file);
-    if (img_surface)
+    const ImageDecoder *decoder = defaultImageDecoder();
+    ImageCacheParams params = { 0, true };
+    CachedImage image;
+    if (imageCacheLoad(img_file, decoder, params, &image))
     {
         GLenum texture_format;
+        GLint width = image.header->width;
+        GLint height = image.header->height;
 
-        if ((img_surface->w & (img_surface->w - 1)) != 0)
+        if ((width & (width - 1)) != 0)
             std::cout << "Image width is not a power of 2" << std::endl;
 
-        if ((img_surface->h & (img_surface->h - 1)) != 0)
+        if ((height & (height - 1)) != 0)
             std::cout << "Image height is not a power of 2" << std::endl;
 
-        GLint nOfColors = img_surface->format->BytesPerPixel;
-        if (nOfColors == 4)     // contains an alpha channel
+        if (image.header->channels == 4)     // contains an alpha channel
             texture_format = GL_RGBA;
-        else if (nOfColors == 3)     // no alpha channel
+        else                                 // no alpha channel
             texture_format = GL_RGB;
-        else
-            std::cout << "the image is not truecolor.." << std::endl;
 
-        std::cout << "Loaded sky image with size: " << img_surface->w << "," << img_surface->h << std::endl;
+        std::cout << "Loaded " << img_file << " with " << decoder->name << ", size: "
+                  << width << "," << height << std::endl;
 
-        glTexImage2D(GL_TEXTURE_2D, 0, texture_format, img_surface->h, img_surface->w, 0,
-                     texture_format, GL_UNSIGNED_BYTE, img_surface->pixels);
+        // cached levels are tightly packed and already mipmapped
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (GLuint level = 0; level < image.header->levels; level++)
+        {
+            const unsigned char *pixels = cachedImageLevel(&image, level, &width, &height);
+            glTexImage2D(GL_TEXTURE_2D, level, texture_format, width, height, 0,
+                         texture_format, GL_UNSIGNED_BYTE, pixels);
+        }
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+        imageCacheRelease(&image);
     }
     else
     {
         std::cout << "Failed to load texture" << std::endl;
     }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    cacheBindTexture(0);
 
    return textureId;
 }
@@ -260,6 +263,15 @@ GLboolean esCreateWindow(Context *contxt, const char* title, GLuint flags)
     if (contxt == NULL)
         return GL_FALSE;
 
+    if (headlessRequested())
+    {
+        contxt->x_display = NULL;
+        contxt->hWnd = (EGLNativeWindowType) 0;
+        return createHeadlessContext(attribList, contxt->width, contxt->height,
+                                     &contxt->eglDisplay, &contxt->eglContext,
+                                     &contxt->eglSurface) ? GL_TRUE : GL_FALSE;
+    }
+
     if (!WinCreate (contxt, title))
         return GL_FALSE;
 
@@ -282,6 +294,9 @@ GLboolean userInterrupt(Context *contxt)
     GLboolean userinterrupt = GL_FALSE;
     char text;
 
+    if (contxt->x_display == NULL)
+        return headlessFinished() ? GL_TRUE : GL_FALSE;
+
     while (XPending(contxt->x_display)) {
         XNextEvent(contxt->x_display, &xev);
         if (xev.type == KeyPress) {
@@ -289,6 +304,9 @@ GLboolean userInterrupt(Context *contxt)
             }
         }
 
+        if (xev.type == Expose)
+            requestFrame(&contxt->scheduler);
+
         if (xev.type == DestroyNotify)
             userinterrupt = GL_TRUE;
     }
@@ -315,7 +333,9 @@ int main(int argc, char *argv[])
 {
     Context contxt;
 
+    initGoldenTest(argc, argv, "images_gles");
     esCreateWindow (&contxt, "GLES", ES_WINDOW_RGB);
+    initFrameScheduler(&contxt.scheduler, contxt.eglDisplay, 1);
 
     Shader ourShader("../src/10.images_gles.vs", "../src/10.images_gles.fs");
     contxt.programObject = ourShader.get_id();
@@ -325,7 +345,19 @@ int main(int argc, char *argv[])
 
     contxt.samplerLoc = glGetUniformLocation(contxt.programObject, "s_texture");
 
-    contxt.numIndices = generateRect(1.6, &contxt.vertices, &contxt.indices);
+    GLfloat *vertices;
+    GLuint *indices;
+    int numIndices = generateRect(1.6, &vertices, &indices);
+
+    // positions fit in [-1, 1]: 8 bytes per vertex instead of 20
+    VertexFormat format;
+    addVertexElement(&format, "v_position", contxt.positionLoc, 3, GL_SHORT, GL_TRUE);
+    addVertexElement(&format, "a_texCoord", contxt.texCoordLoc, 2, GL_UNSIGNED_BYTE, GL_TRUE);
+    contxt.rect = createEncodedMesh(&contxt.buffers, &format, vertices, 4,
+                                    indices, numIndices, GL_STATIC_DRAW);
+    free(vertices);
+    free(indices);
+
     contxt.mvpLoc = glGetUniformLocation(contxt.programObject, "u_mvpMatrix");
 
     contxt.textureId = createTexture("../img/sky.jpg");
@@ -334,29 +366,33 @@ int main(int argc, char *argv[])
 
     while (userInterrupt(&contxt) == GL_FALSE)
     {
+        // nothing changed since the last frame, sleep until X has events
+        if (!beginFrame(&contxt.scheduler))
+        {
+            waitForEvents(&contxt.scheduler, contxt.x_display, -1);
+            continue;
+        }
+
         glClear ( GL_COLOR_BUFFER_BIT );
 
         updateRect(&contxt);
 
         ourShader.use();
 
-        glVertexAttribPointer(contxt.positionLoc, 3, GL_FLOAT,
-                              GL_FALSE, 5 * sizeof(GLfloat), contxt.vertices);
-        glVertexAttribPointer(contxt.texCoordLoc, 2, GL_FLOAT,
-                              GL_FALSE, 5 * sizeof(GLfloat), &contxt.vertices[3]);
-
-        glEnableVertexAttribArray (contxt.positionLoc);
-        glEnableVertexAttribArray (contxt.texCoordLoc);
-
         glUniformMatrix4fv(contxt.mvpLoc, 1, GL_FALSE, (GLfloat*) &contxt.mvpMatrix.m[0][0]);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, contxt.textureId);
+        cacheActiveTexture(GL_TEXTURE0);
+        cacheBindTexture(contxt.textureId);
 
-        glDrawElements(GL_TRIANGLES, contxt.numIndices, GL_UNSIGNED_INT, contxt.indices);
+        drawMesh(&contxt.rect);
 
         eglSwapBuffers(contxt.eglDisplay, contxt.eglSurface);
     }
 
-    return 0;
+    int status = goldenTest.enabled ? finishGoldenTest(contxt.width, contxt.height) : 0;
+
+    destroyMesh(&contxt.rect);
+    destroyBuffers(&contxt.buffers);
+
+    return status;
 }
@@ -1,20 +1,40 @@
 #include <GLES2/gl2.h>
 #include <EGL/egl.h>
+#include <X11/keysym.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <math.h>
 #include <stdlib.h>
 #include <iostream>
 #include <string.h>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 
-#include <SDL.h>
-#include <SDL_image.h>
-
 #include <shader_gles.h>
+#include <buffer_gles.h>
+#include <sprite_batch_gles.h>
+#include <scene_store.h>
+#include <render_queue.h>
+#include <animation.h>
+#include <object_pool.h>
+#include <frame_scheduler.h>
+#include <headless_egl.h>
+#include <golden_image.h>
+#include <damage_gles.h>
+#include <triple_buffer.h>
+#include <worker_pool.h>
+#include <command_buffer_gles.h>
+#include <input_thread_x11.h>
+#include <frame_fence.h>
+#include <image_cache.h>
 
 #define ES_WINDOW_RGB           0
 #define ES_WINDOW_ALPHA         1
@@ -22,38 +42,112 @@
 #define ES_WINDOW_STENCIL       4
 #define ES_WINDOW_MULTISAMPLE   8
 
-#define VERTEX_POS_SIZE         3
-#define VERTEX_NORMAL_SIZE      3
-#define VERTEX_TEXCOORD0_SIZE   2
+// Cards materialized on each side of the focused item
+#define CAROUSEL_HALF_WINDOW    6
+#define CAROUSEL_MAX_CARDS      (2 * CAROUSEL_HALF_WINDOW + 1)
 
-#define VERTEX_POS_INDX         0
-#define VERTEX_NORMAL_INDX      1
-#define VERTEX_TEXCOORD0_INDX   2
+// Unbatched draws recorded per worker slice, fewer aren't worth a slice. A
+// full window makes three slices.
+#define CARD_SLICE_MIN_DRAWS    4
 
-typedef struct _bitmap
-{
-    GLuint textureId;
+// Frames queued ahead of the GPU at most, FRAMES_IN_FLIGHT overrides
+#define CAROUSEL_FRAMES_IN_FLIGHT 2
 
-    GLfloat *vertices;
-    GLuint *indices;
-    GLfloat position[3] = {0.0f, 0.0f, 0.0f};
-    int numIndices;
+// Events the input thread selects on the window
+#define CAROUSEL_INPUT_EVENTS   (ExposureMask | KeyPressMask | StructureNotifyMask)
 
-    GLfloat xOffset;
-    GLfloat yOffset;
-    GLfloat zOffset;
+#define VIEW_NEAR               0.1f
+#define VIEW_FAR                20.0f
 
-    GLint positionLoc;
-    GLint texCoordLoc;
-    GLint samplerLoc;
-    GLint mvpLoc;
-} Bitmap;
+// Locations shared by every card drawn with a program, looked up once
+typedef struct _cardProgram
+{
+    GLuint program;
+    GLint xOffset;
+    GLint yOffset;
+    GLint zOffset;
+    GLint scale;
+    GLint color;
+} CardProgram;
+
+// A texture shared by every live card showing the same image, allocated
+// from Context::textureEntries
+typedef struct _textureEntry
+{
+    GLuint texture;
+    int refs;
+} TextureEntry;
+
+typedef struct _carouselCard
+{
+    int item;
+    uint32_t image;
+    SceneHandle card;
+} CarouselCard;
+
+// The whole collection is a list of image indices; only the window around
+// scroll holds scene items and textures. images and items are fixed before
+// the simulation thread starts, the scroll state belongs to that thread and
+// the live cards to the render thread.
+typedef struct _carousel
+{
+    std::vector<std::string> images;
+    std::vector<uint32_t> items;
+    float scroll = 1.0f;        // item index in focus, at the last tick
+    float previousScroll = 1.0f;
+    float target = 1.0f;
+    float speed = 0.0f;         // items per second, --scroll
+    std::vector<CarouselCard> live;
+    size_t peakCards = 0;
+    size_t peakTextures = 0;
+} Carousel;
+
+// A window card at the last two ticks: x, y, z, opacity 0-255
+typedef struct _cardSnapshot
+{
+    uint32_t image;
+    GLfloat previous[4];
+    GLfloat current[4];
+} CardSnapshot;
+
+// What the simulation thread hands the render thread, never changed once
+// published. cards[i] shows item first + i.
+typedef struct _frameSnapshot
+{
+    int first = 0;
+    std::vector<CardSnapshot> cards;
+    double tickTime = 0.0;      // steady clock seconds when current was simulated
+    bool moving = false;
+} FrameSnapshot;
 
 typedef struct _context
 {
     GLuint programObject;
 
-    std::vector<Bitmap*> bmaps;
+    SceneStore cards;
+    std::vector<CardProgram> programs;
+    ObjectPool<TextureEntry> textureEntries;
+    std::vector<TextureEntry *> textures;           // by image index, NULL when not resident
+    std::vector<GLuint> freeTextures;               // released, reused by createTexture
+    Carousel carousel;
+    AnimationClock clock;               // simulation thread
+    TripleBuffer snapshots;
+    FrameSnapshot frames[3];            // slots of snapshots
+    std::thread simulation;
+    std::mutex inputMutex;              // guards the three below
+    std::condition_variable inputChanged;
+    int pendingSteps = 0;               // Left/Right presses not simulated yet
+    bool running = true;
+    glm::mat4 viewProjection;
+    RenderQueue queue;
+    RenderStats totals = {};
+    BufferManager buffers;
+    Mesh quad;
+    SpriteBatch batch;
+    bool batched = true;
+    WorkerPool workers;
+    std::vector<CommandBuffer> slices;      // recorded by workers, replayed in order
+    std::vector<RenderStats> sliceStats;
 
     GLint width = 1280;
     GLint height = 720;
@@ -64,6 +158,14 @@ typedef struct _context
     EGLContext  eglContext;
     EGLSurface  eglSurface;
 
+    FrameScheduler scheduler;
+    DamageTracker damage;
+    FrameFences fences;
+    InputThread input;
+    int inputEvents = 0;
+    double inputDelay = 0.0;            // from read to drained, summed
+    double maxInputDelay = 0.0;
+
 } Context;
 
 // camera
@@ -73,47 +175,55 @@ glm::vec3 cameraUp    = glm::vec3(0.0f, 1.0f,  0.0f);
 
 GLfloat fov = 45.0f;
 
-GLuint createTexture(const char *img_file)
+// Loads img_file into textureId, or into a new texture when it is 0
+GLuint createTexture(const char *img_file, GLuint textureId)
 {
-    GLuint textureId;
-
-    glGenTextures(1, &textureId);
-    glBindTexture(GL_TEXTURE_2D, textureId);
-
-    SDL_Surface* img_surface = IMG_Load(img_file);
-    if (img_surface)
+    if (textureId == 0)
+        glGenTextures(1, &textureId);
+    cacheBindTexture(textureId);
+
+    const ImageDecoder *decoder = defaultImageDecoder();
+    ImageCacheParams params = { 0, true };
+    CachedImage image;
+    if (imageCacheLoad(img_file, decoder, params, &image))
     {
         GLenum texture_format;
+        GLint width = image.header->width;
+        GLint height = image.header->height;
 
-        if ((img_surface->w & (img_surface->w - 1)) != 0)
+        if ((width & (width - 1)) != 0)
             std::cout << "Image width is not a power of 2" << std::endl;
 
-        if ((img_surface->h & (img_surface->h - 1)) != 0)
+        if ((height & (height - 1)) != 0)
             std::cout << "Image height is not a power of 2" << std::endl;
 
-        GLint nOfColors = img_surface->format->BytesPerPixel;
-        if (nOfColors == 4)     // contains an alpha channel
+        if (image.header->channels == 4)     // contains an alpha channel
             texture_format = GL_RGBA;
-        else if (nOfColors == 3)     // no alpha channel
+        else                                 // no alpha channel
             texture_format = GL_RGB;
-        else
-            std::cout << "the image is not truecolor.." << std::endl;
 
-        std::cout << "Loaded sky image with size: " << img_surface->w << "," << img_surface->h << std::endl;
+        std::cout << "Loaded " << img_file << " with " << decoder->name << ", size: "
+                  << width << "," << height << std::endl;
 
-        glTexImage2D(GL_TEXTURE_2D, 0, texture_format, img_surface->h, img_surface->w, 0,
-                     texture_format, GL_UNSIGNED_BYTE, img_surface->pixels);
+        // cached levels are tightly packed and already mipmapped
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (GLuint level = 0; level < image.header->levels; level++)
+        {
+            const unsigned char *pixels = cachedImageLevel(&image, level, &width, &height);
+            glTexImage2D(GL_TEXTURE_2D, level, texture_format, width, height, 0,
+                         texture_format, GL_UNSIGNED_BYTE, pixels);
+        }
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+        imageCacheRelease(&image);
     }
     else
     {
         std::cout << "Failed to load texture" << std::endl;
     }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+    cacheBindTexture(0);
 
    return textureId;
 }
@@ -160,11 +270,15 @@ int generateRect(float scale, GLfloat **vertices, GLuint **indices)
     return numIndices;
 }
 
-void moveRect(Bitmap *bitmap, float x, float y, float z)
+void moveRect(SceneStore *cards, SceneHandle card, float x, float y, float z)
 {
-    bitmap->position[0] = x;
-    bitmap->position[1] = y;
-    bitmap->position[2] = z;
+    int index = sceneItemIndex(cards, card);
+    if (index < 0)
+        return;
+
+    cards->positions[index * 3] = x;
+    cards->positions[index * 3 + 1] = y;
+    cards->positions[index * 3 + 2] = z;
 }
 
 EGLBoolean WinCreate(Context *contxt, const char *title)
@@ -184,7 +298,8 @@ EGLBoolean WinCreate(Context *contxt, const char *title)
 
     root = DefaultRootWindow(x_display);
 
-    swa.event_mask  =  ExposureMask | PointerMotionMask | KeyPressMask;
+    // events are read by the input thread on its own connection
+    swa.event_mask  =  NoEventMask;
     win = XCreateWindow(x_display, root,
                0, 0, contxt->width, contxt->height, 0,
                CopyFromParent, InputOutput,
@@ -284,6 +399,15 @@ GLboolean esCreateWindow(Context *contxt, const char* title, GLuint flags)
     if (contxt == NULL)
         return GL_FALSE;
 
+    if (headlessRequested())
+    {
+        contxt->x_display = NULL;
+        contxt->hWnd = (EGLNativeWindowType) 0;
+        return createHeadlessContext(attribList, contxt->width, contxt->height,
+                                     &contxt->eglDisplay, &contxt->eglContext,
+                                     &contxt->eglSurface) ? GL_TRUE : GL_FALSE;
+    }
+
     if (!WinCreate (contxt, title))
         return GL_FALSE;
 
@@ -299,21 +423,40 @@ GLboolean esCreateWindow(Context *contxt, const char* title, GLuint flags)
     return GL_TRUE;
 }
 
+// Drains what the input thread queued since the last frame
 GLboolean userInterrupt(Context *contxt)
 {
-    XEvent xev;
-    KeySym key;
+    InputEvent event;
     GLboolean userinterrupt = GL_FALSE;
-    char text;
-
-    while (XPending(contxt->x_display)) {
-        XNextEvent(contxt->x_display, &xev);
-        if (xev.type == KeyPress) {
-            if (XLookupString(&xev.xkey, &text, 1, &key, 0) == 1) {
+    double now = inputClock();
+
+    if (contxt->x_display == NULL)
+        return headlessFinished() ? GL_TRUE : GL_FALSE;
+
+    while (popInputEvent(&contxt->input.queue, &event)) {
+        double delay = now - event.time;
+        contxt->inputEvents++;
+        contxt->inputDelay += delay;
+        contxt->maxInputDelay = std::max(contxt->maxInputDelay, delay);
+
+        if (event.type == INPUT_KEY_PRESS) {
+            if (event.key == XK_Left || event.key == XK_Right)
+            {
+                std::lock_guard<std::mutex> lock(contxt->inputMutex);
+                contxt->pendingSteps += event.key == XK_Left ? -1 : 1;
+                contxt->inputChanged.notify_one();
             }
+            if (event.key == XK_Escape)
+                userinterrupt = GL_TRUE;
+        }
+
+        if (event.type == INPUT_EXPOSE)
+        {
+            requestFrame(&contxt->scheduler);
+            damageAll(&contxt->damage);
         }
 
-        if (xev.type == DestroyNotify)
+        if (event.type == INPUT_CLOSE)
             userinterrupt = GL_TRUE;
     }
 
@@ -329,7 +472,8 @@ void updateView(Context* contxt)
     float aspect = (GLfloat) contxt->width / (GLfloat) contxt->height;
 
     view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-    projection = glm::perspective(45.0f, aspect, 0.1f, 20.0f);
+    projection = glm::perspective(45.0f, aspect, VIEW_NEAR, VIEW_FAR);
+    contxt->viewProjection = projection * view;
 
     // Retrieve the matrix uniform locations
     GLint modelLoc = glGetUniformLocation(contxt->programObject, "model");
@@ -342,86 +486,730 @@ void updateView(Context* contxt)
     glUniformMatrix4fv(projectLoc, 1, GL_FALSE, glm::value_ptr(projection));
 }
 
-void drawBitmap(Context *contxt, Bitmap *bitmap)
+// Window rectangle covered by a card, padded a pixel for filtering. Cards
+// crossing the eye plane cover the whole window.
+void cardBounds(Context *contxt, int index, GLfloat bounds[4])
+{
+    const SceneStore *cards = &contxt->cards;
+    const GLfloat *position = &cards->positions[index * 3];
+    GLfloat half = cards->scales[index] * 0.5f;
+
+    bounds[0] = bounds[1] = 1e30f;
+    bounds[2] = bounds[3] = -1e30f;
+    for (int corner = 0; corner < 4; corner++)
+    {
+        GLfloat x = position[0] + (corner & 1 ? half : -half);
+        GLfloat y = position[1] + (corner & 2 ? half : -half);
+        glm::vec4 clip = contxt->viewProjection * glm::vec4(x, y, position[2], 1.0f);
+        if (clip.w <= 0.0f)
+        {
+            bounds[0] = bounds[1] = 0.0f;
+            bounds[2] = contxt->width;
+            bounds[3] = contxt->height;
+            return;
+        }
+
+        GLfloat windowX = (clip.x / clip.w * 0.5f + 0.5f) * contxt->width;
+        GLfloat windowY = (clip.y / clip.w * 0.5f + 0.5f) * contxt->height;
+        bounds[0] = std::min(bounds[0], windowX - 1.0f);
+        bounds[1] = std::min(bounds[1], windowY - 1.0f);
+        bounds[2] = std::max(bounds[2], windowX + 1.0f);
+        bounds[3] = std::max(bounds[3], windowY + 1.0f);
+    }
+}
+
+// Flags the cards whose bounding square overlaps the view and damages
+// where the ones that moved were and are
+void cullCards(Context *contxt)
+{
+    SceneStore *cards = &contxt->cards;
+    const glm::mat4 &viewProjection = contxt->viewProjection;
+    int count = sceneItemCount(cards);
+
+    for (int i = 0; i < count; i++)
+    {
+        const GLfloat *position = &cards->positions[i * 3];
+        glm::vec4 clip = viewProjection * glm::vec4(position[0], position[1], position[2], 1.0f);
+
+        // half diagonal of the card, taken to clip space by the projection scale
+        GLfloat radius = cards->scales[i] * 0.7072f;
+        GLfloat radiusX = radius * viewProjection[0][0];
+        GLfloat radiusY = radius * viewProjection[1][1];
+
+        // w is the distance along the view direction
+        cards->depths[i] = clip.w;
+        cards->visible[i] = clip.w + radius > 0.0f &&
+                            fabsf(clip.x) <= clip.w + radiusX &&
+                            fabsf(clip.y) <= clip.w + radiusY;
+
+        // a card that moved damages where it was and where it is now
+        GLfloat bounds[4];
+        cardBounds(contxt, i, bounds);
+        GLfloat *previous = &cards->bounds[i * 4];
+        if (memcmp(bounds, previous, sizeof(bounds)) != 0)
+        {
+            addDamage(&contxt->damage, previous[0], previous[1], previous[2], previous[3]);
+            addDamage(&contxt->damage, bounds[0], bounds[1], bounds[2], bounds[3]);
+            memcpy(previous, bounds, sizeof(bounds));
+        }
+    }
+}
+
+// Render queue callbacks, state changes only happen at key boundaries.
+// Translucent cards blend over what is behind them and leave depth alone.
+void bindCardLayer(void *user, uint32_t layer)
+{
+    if (layer >= RENDER_LAYER_TRANSLUCENT)
+    {
+        cacheEnable(GL_BLEND, true);
+        cacheBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        cacheDepthMask(GL_FALSE);
+    }
+    else
+    {
+        cacheEnable(GL_BLEND, false);
+        cacheDepthMask(GL_TRUE);
+    }
+}
+
+// Quads queued under the previous state must be drawn before it changes
+void bindBatchLayer(void *user, uint32_t layer)
+{
+    Context *contxt = (Context *) user;
+
+    flushSpriteBatch(&contxt->batch);
+    bindCardLayer(user, layer);
+}
+
+void bindCardProgram(void *user, uint32_t program)
+{
+    Context *contxt = (Context *) user;
+
+    cacheUseProgram(contxt->programs[program].program);
+}
+
+void bindCardTexture(void *user, uint32_t texture)
+{
+    cacheActiveTexture(GL_TEXTURE0);
+    cacheBindTexture(texture);
+}
+
+void drawBitmap(Context *contxt, int index)
+{
+    const SceneStore *cards = &contxt->cards;
+    const CardProgram *program = &contxt->programs[cards->programs[index]];
+    const GLfloat *position = &cards->positions[index * 3];
+
+    glUniform1f(program->xOffset, position[0]);
+    glUniform1f(program->yOffset, position[1]);
+    glUniform1f(program->zOffset, position[2]);
+    glUniform1f(program->scale, cards->scales[index]);
+
+    // the quad has no color array, feed the shader a constant white
+    if (program->color >= 0)
+        glVertexAttrib4f(program->color, 1.0f, 1.0f, 1.0f, cards->opacities[index] / 255.0f);
+
+    drawMesh(&contxt->quad);
+}
+
+// Same result as drawBitmap, but queued into the sprite batch
+void batchBitmap(Context *contxt, int index)
+{
+    const SceneStore *cards = &contxt->cards;
+    const GLfloat uv[] = { 0.0f, 0.0f, 1.0f, 1.0f };
+    const GLubyte color[] = { 255, 255, 255, cards->opacities[index] };
+    GLfloat scale = cards->scales[index];
+
+    drawSprite(&contxt->batch, cards->textures[index], &cards->positions[index * 3],
+               scale, scale, uv, color);
+}
+
+void drawCard(void *user, uint32_t index)
+{
+    drawBitmap((Context *) user, index);
+}
+
+void batchCard(void *user, uint32_t index)
+{
+    batchBitmap((Context *) user, index);
+}
+
+// Worker side of the unbatched path: what bindCardLayer, bindCardProgram,
+// bindCardTexture and drawBitmap do, recorded for the GL thread
+typedef struct _cardRecorder
+{
+    const Context *contxt;
+    CommandBuffer *commands;
+} CardRecorder;
+
+void recordCardLayer(void *user, uint32_t layer)
+{
+    CommandBuffer *commands = ((CardRecorder *) user)->commands;
+    bool translucent = layer >= RENDER_LAYER_TRANSLUCENT;
+
+    recordEnable(commands, GL_BLEND, translucent);
+    if (translucent)
+        recordBlendFunc(commands, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    recordDepthMask(commands, !translucent);
+}
+
+void recordCardProgram(void *user, uint32_t program)
+{
+    CardRecorder *recorder = (CardRecorder *) user;
+
+    recordUseProgram(recorder->commands, recorder->contxt->programs[program].program);
+}
+
+void recordCardTexture(void *user, uint32_t texture)
+{
+    recordBindTexture(((CardRecorder *) user)->commands, texture);
+}
+
+void recordCard(void *user, uint32_t index)
+{
+    CardRecorder *recorder = (CardRecorder *) user;
+    const SceneStore *cards = &recorder->contxt->cards;
+    const CardProgram *program = &recorder->contxt->programs[cards->programs[index]];
+    const GLfloat *position = &cards->positions[index * 3];
+    CommandBuffer *commands = recorder->commands;
+
+    recordUniform1f(commands, program->xOffset, position[0]);
+    recordUniform1f(commands, program->yOffset, position[1]);
+    recordUniform1f(commands, program->zOffset, position[2]);
+    recordUniform1f(commands, program->scale, cards->scales[index]);
+    if (program->color >= 0)
+        recordVertexAttrib4f(commands, program->color, 1.0f, 1.0f, 1.0f,
+                             cards->opacities[index] / 255.0f);
+    recordDrawMesh(commands, &recorder->contxt->quad);
+}
+
+// Worker job: one contiguous slice of the sorted queue
+void recordSlice(void *user, int slice)
+{
+    Context *contxt = (Context *) user;
+    size_t count = contxt->queue.entries.size();
+    size_t numSlices = contxt->slices.size();
+    size_t begin = count * slice / numSlices;
+    size_t end = count * (slice + 1) / numSlices;
+
+    CardRecorder recorder = { contxt, &contxt->slices[slice] };
+    RenderCallbacks callbacks = { recordCardLayer, recordCardProgram, recordCardTexture,
+                                  recordCard, &recorder };
+
+    resetCommandBuffer(recorder.commands);
+    memset(&contxt->sliceStats[slice], 0, sizeof(RenderStats));
+    executeRenderRange(&contxt->queue, begin, end, &callbacks, &contxt->sliceStats[slice]);
+}
+
+void addRenderStats(RenderStats *totals, const RenderStats *frame)
+{
+    totals->draws += frame->draws;
+    totals->programBinds += frame->programBinds;
+    totals->textureBinds += frame->textureBinds;
+    totals->naiveProgramBinds += frame->naiveProgramBinds;
+    totals->naiveTextureBinds += frame->naiveTextureBinds;
+}
+
+// Draws the cards reaching into area, the scissor rectangle
+void drawBitmaps(Context *contxt, const DamageRect *area)
+{
+    const SceneStore *cards = &contxt->cards;
+    int count = sceneItemCount(cards);
+
+    // opaque cards sorted by state then front to back, translucent ones
+    // after them from back to front
+    beginRenderQueue(&contxt->queue);
+    for (int i = 0; i < count; i++)
+    {
+        const GLfloat *bounds = &cards->bounds[i * 4];
+        if (!cards->visible[i] || bounds[2] <= area->x0 || bounds[0] >= area->x1 ||
+            bounds[3] <= area->y0 || bounds[1] >= area->y1)
+            continue;
+
+        uint32_t layer = cards->opacities[i] == 255 ? 0 : RENDER_LAYER_TRANSLUCENT;
+        uint32_t depth = quantizeDepth(cards->depths[i], VIEW_NEAR, VIEW_FAR);
+        submitDraw(&contxt->queue,
+                   makeRenderKey(layer, cards->programs[i], cards->textures[i], depth), i);
+    }
+    sortRenderQueue(&contxt->queue);
+
+    // unbatched: workers record slices of the queue in parallel, then this
+    // thread replays them in queue order
+    if (!contxt->batched)
+    {
+        size_t numSlices = contxt->queue.entries.size() / CARD_SLICE_MIN_DRAWS;
+        numSlices = std::max((size_t) 1, std::min(numSlices, contxt->workers.threads.size() + 1));
+        contxt->slices.resize(numSlices);
+        contxt->sliceStats.resize(numSlices);
+
+        runWorkerJobs(&contxt->workers, numSlices, recordSlice, contxt);
+
+        cacheActiveTexture(GL_TEXTURE0);
+        for (size_t i = 0; i < numSlices; i++)
+        {
+            replayCommandBuffer(&contxt->slices[i]);
+            addRenderStats(&contxt->queue.stats, &contxt->sliceStats[i]);
+        }
+        bindCardLayer(contxt, 0);
+        addRenderStats(&contxt->totals, &contxt->queue.stats);
+        return;
+    }
+
+    // batched vertices are already in world space
+    const CardProgram *program = &contxt->programs[0];
+    glUniform1f(program->xOffset, 0.0f);
+    glUniform1f(program->yOffset, 0.0f);
+    glUniform1f(program->zOffset, 0.0f);
+    glUniform1f(program->scale, 1.0f);
+
+    // the batch flushes whenever the texture changes, i.e. at key boundaries
+    RenderCallbacks callbacks = { bindBatchLayer, bindCardProgram, NULL, batchCard, contxt };
+
+    beginSpriteBatch(&contxt->batch);
+    executeRenderQueue(&contxt->queue, &callbacks);
+    endSpriteBatch(&contxt->batch);
+    bindCardLayer(contxt, 0);
+    addRenderStats(&contxt->totals, &contxt->queue.stats);
+}
+
+CardProgram createCardProgram(GLuint programObject)
+{
+    CardProgram program;
+
+    program.program = programObject;
+    program.xOffset = glGetUniformLocation(programObject, "xOffset");
+    program.yOffset = glGetUniformLocation(programObject, "yOffset");
+    program.zOffset = glGetUniformLocation(programObject, "zOffset");
+    program.scale = glGetUniformLocation(programObject, "scale");
+    program.color = glGetAttribLocation(programObject, "a_color");
+
+    return program;
+}
+
+// image indexes Carousel::images
+SceneHandle createBitmap(Context *contxt, uint32_t image)
+{
+    SceneHandle card = createSceneItem(&contxt->cards);
+    int index = sceneItemIndex(&contxt->cards, card);
+
+    TextureEntry *entry = contxt->textures[image];
+    if (entry == NULL)
+    {
+        GLuint recycled = 0;
+        if (!contxt->freeTextures.empty())
+        {
+            recycled = contxt->freeTextures.back();
+            contxt->freeTextures.pop_back();
+        }
+
+        entry = poolAlloc(&contxt->textureEntries);
+        entry->texture = createTexture(contxt->carousel.images[image].c_str(), recycled);
+        contxt->textures[image] = entry;
+    }
+    entry->refs++;
+
+    contxt->cards.textures[index] = entry->texture;
+    contxt->cards.scales[index] = 0.6f;
+    contxt->cards.programs[index] = 0;
+
+    return card;
+}
+
+void destroyBitmap(Context *contxt, SceneHandle card, uint32_t image)
 {
-    glVertexAttribPointer(bitmap->positionLoc, 3, GL_FLOAT, GL_FALSE,
-                          5 * sizeof(GLfloat), bitmap->vertices);
-    glVertexAttribPointer(bitmap->texCoordLoc, 2, GL_FLOAT, GL_FALSE,
-                          5 * sizeof(GLfloat), &bitmap->vertices[3]);
+    TextureEntry *entry = contxt->textures[image];
+    if (entry != NULL && --entry->refs == 0)
+    {
+        contxt->freeTextures.push_back(entry->texture);
+        poolFree(&contxt->textureEntries, entry);
+        contxt->textures[image] = NULL;
+    }
 
-    glEnableVertexAttribArray (bitmap->positionLoc);
-    glEnableVertexAttribArray (bitmap->texCoordLoc);
+    int index = sceneItemIndex(&contxt->cards, card);
+    if (index >= 0)
+    {
+        const GLfloat *bounds = &contxt->cards.bounds[index * 4];
+        addDamage(&contxt->damage, bounds[0], bounds[1], bounds[2], bounds[3]);
+    }
+    destroySceneItem(&contxt->cards, card);
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, bitmap->textureId);
+// Cards fan out from the focused one, receding and fading as they get
+// further from it. Returns the card's opacity.
+GLubyte carouselLayout(float offset, GLfloat position[3])
+{
+    float distance = fabsf(offset);
 
-    glUniform1f(bitmap->xOffset, bitmap->position[0]);
-    glUniform1f(bitmap->yOffset, bitmap->position[1]);
-    glUniform1f(bitmap->zOffset, bitmap->position[2]);
+    position[0] = 0.7f * offset;
+    position[1] = 0.0f;
+    position[2] = -0.45f * distance;
 
-    glDrawElements(GL_TRIANGLES, bitmap->numIndices, GL_UNSIGNED_INT, bitmap->indices);
+    if (distance <= 1.0f)
+        return 255;
+    return (GLubyte) (255.0f * std::max(0.25f, 1.0f - 0.25f * (distance - 1.0f)));
 }
 
-Bitmap* createBitmap(Context *contxt, const char *img_file)
+// One simulation tick of scrolling, step is in seconds
+void stepCarousel(Carousel *carousel, float step)
 {
-    Bitmap* bitmap = (Bitmap*) malloc(sizeof(Bitmap));
+    int numItems = carousel->items.size();
+
+    if (carousel->speed != 0.0f)
+        carousel->target += carousel->speed * step;
+    if (carousel->target < 0.0f)
+        carousel->target = 0.0f;
+    if (carousel->target > numItems - 1)
+        carousel->target = numItems - 1;
+
+    // ease towards the target, 10 items per second at most
+    float limit = 10.0f * step;
+    float distance = carousel->target - carousel->scroll;
+    carousel->previousScroll = carousel->scroll;
+    carousel->scroll += fabsf(distance) <= limit ? distance : (distance > 0 ? limit : -limit);
+}
 
-    bitmap->textureId = createTexture(img_file);
+// Simulation thread: lays out the window around scroll at the last two
+// ticks and publishes it. Cost depends on the window, not the collection.
+void publishCarousel(Context *contxt, double tickTime, bool moving)
+{
+    Carousel *carousel = &contxt->carousel;
+    FrameSnapshot *snapshot = &contxt->frames[tripleBufferWriteSlot(&contxt->snapshots)];
+    int numItems = carousel->items.size();
+
+    int focus = (int) floorf(carousel->scroll + 0.5f);
+    snapshot->first = std::max(0, focus - CAROUSEL_HALF_WINDOW);
+    snapshot->tickTime = tickTime;
+    snapshot->moving = moving;
+    snapshot->cards.clear();
+
+    int last = std::min(numItems - 1, focus + CAROUSEL_HALF_WINDOW);
+    for (int item = snapshot->first; item <= last; item++)
+    {
+        CardSnapshot card;
+        card.image = carousel->items[item];
+        card.previous[3] = carouselLayout(item - carousel->previousScroll, card.previous);
+        card.current[3] = carouselLayout(item - carousel->scroll, card.current);
+        snapshot->cards.push_back(card);
+    }
 
-    bitmap->positionLoc = glGetAttribLocation(contxt->programObject, "v_position");
-    bitmap->texCoordLoc = glGetAttribLocation(contxt->programObject, "a_texCoord");
+    publishTripleBuffer(&contxt->snapshots);
+    wakeFrameScheduler(&contxt->scheduler);
+}
 
-    bitmap->samplerLoc = glGetUniformLocation(contxt->programObject, "s_texture");
+// Runs the ticks owed for elapsed seconds and publishes the result, now is
+// the time of the last one. Returns whether the carousel still moves.
+bool advanceCarousel(Context *contxt, double elapsed, double now, bool *wasMoving)
+{
+    Carousel *carousel = &contxt->carousel;
 
-    bitmap->numIndices = generateRect(0.6, &bitmap->vertices, &bitmap->indices);
-    bitmap->mvpLoc = glGetUniformLocation(contxt->programObject, "u_mvpMatrix");
+    int ticks = advanceAnimationClock(&contxt->clock, elapsed);
+    for (int i = 0; i < ticks; i++)
+    {
+        nextAnimationTick(&contxt->clock);
+        stepCarousel(carousel, contxt->clock.step);
+    }
 
-    bitmap->xOffset = glGetUniformLocation(contxt->programObject, "xOffset");
-    bitmap->yOffset = glGetUniformLocation(contxt->programObject, "yOffset");
-    bitmap->zOffset = glGetUniformLocation(contxt->programObject, "zOffset");
+    bool moving = carousel->speed != 0.0f || carousel->scroll != carousel->target ||
+                  carousel->scroll != carousel->previousScroll;
+    // one more snapshot once at rest, so the last one isn't left mid tick
+    if (ticks > 0 && (moving || *wasMoving))
+    {
+        publishCarousel(contxt, now, moving);
+        *wasMoving = moving;
+    }
 
-   return bitmap;
+    return moving;
+}
+
+// Simulation thread body: fixed ticks while the carousel moves, asleep
+// until input arrives while it rests. Touches neither GL nor X.
+void simulateCarousel(Context *contxt)
+{
+    Carousel *carousel = &contxt->carousel;
+    std::chrono::steady_clock::time_point lastTick = std::chrono::steady_clock::now();
+    bool wasMoving = false;
+
+    std::unique_lock<std::mutex> lock(contxt->inputMutex);
+    while (contxt->running)
+    {
+        carousel->target += contxt->pendingSteps;
+        contxt->pendingSteps = 0;
+        lock.unlock();
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        bool moving = advanceCarousel(contxt,
+                                      std::chrono::duration<double>(now - lastTick).count(),
+                                      std::chrono::duration<double>(now.time_since_epoch()).count(),
+                                      &wasMoving);
+        lastTick = now;
+
+        lock.lock();
+        if (moving || wasMoving)
+        {
+            std::chrono::duration<double> step(contxt->clock.step);
+            contxt->inputChanged.wait_for(lock, step);
+        }
+        else
+        {
+            while (contxt->running && contxt->pendingSteps == 0)
+                contxt->inputChanged.wait(lock);
+            // time spent asleep is not animation time
+            lastTick = std::chrono::steady_clock::now();
+        }
+    }
+}
+
+// Render thread: materializes the cards entering the snapshot's window and
+// recycles the ones leaving it
+void applySnapshot(Context *contxt, const FrameSnapshot *snapshot)
+{
+    Carousel *carousel = &contxt->carousel;
+    int first = snapshot->first;
+    int last = first + (int) snapshot->cards.size() - 1;
+
+    for (size_t i = 0; i < carousel->live.size();)
+    {
+        CarouselCard &live = carousel->live[i];
+        if (live.item >= first && live.item <= last)
+        {
+            i++;
+            continue;
+        }
+
+        destroyBitmap(contxt, live.card, live.image);
+        live = carousel->live.back();
+        carousel->live.pop_back();
+    }
+
+    // the live list is small, a linear lookup is enough
+    for (int item = first; item <= last; item++)
+    {
+        bool present = false;
+        for (const CarouselCard &live : carousel->live)
+            present = present || live.item == item;
+        if (present)
+            continue;
+
+        uint32_t image = snapshot->cards[item - first].image;
+        CarouselCard live = { item, image, createBitmap(contxt, image) };
+        carousel->live.push_back(live);
+    }
+
+    carousel->peakCards = std::max(carousel->peakCards, carousel->live.size());
+    carousel->peakTextures = std::max(carousel->peakTextures, (size_t) contxt->textureEntries.live);
+}
+
+// Render thread: places the cards between the snapshot's two ticks
+void layoutCards(Context *contxt, const FrameSnapshot *snapshot, float alpha)
+{
+    for (const CarouselCard &live : contxt->carousel.live)
+    {
+        const CardSnapshot &card = snapshot->cards[live.item - snapshot->first];
+        GLfloat blended[4];
+        for (int c = 0; c < 4; c++)
+            blended[c] = card.previous[c] + (card.current[c] - card.previous[c]) * alpha;
+
+        moveRect(&contxt->cards, live.card, blended[0], blended[1], blended[2]);
+        contxt->cards.opacities[sceneItemIndex(&contxt->cards, live.card)] =
+            (GLubyte) (blended[3] + 0.5f);
+    }
 }
 
 int main(int argc, char *argv[])
 {
     Context contxt;
 
-    esCreateWindow (&contxt, "GLES", ES_WINDOW_RGB);
+    int numItems = 3;
+    double goldenTime = 0.0;
+    bool goldenMoving = false;
+    int numWorkers = std::max(0, (int) std::thread::hardware_concurrency() - 1);
+
+    // --unbatched draws every card with its own uniforms and draw call,
+    // --items sets the collection size, --scroll auto scrolls in items/s,
+    // --workers sets the threads recording unbatched draws (0 records here)
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--unbatched") == 0)
+            contxt.batched = false;
+        else if (strcmp(argv[i], "--items") == 0 && i + 1 < argc)
+            numItems = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--scroll") == 0 && i + 1 < argc)
+            contxt.carousel.speed = atof(argv[++i]);
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            numWorkers = std::max(0, atoi(argv[++i]));
+    }
+
+    initGoldenTest(argc, argv, "carousel_gles");
+    esCreateWindow (&contxt, "GLES", ES_WINDOW_RGB | ES_WINDOW_DEPTH);
+    initFrameScheduler(&contxt.scheduler, contxt.eglDisplay, 1);
+    initDamageTracker(&contxt.damage, contxt.eglDisplay, contxt.eglSurface,
+                      contxt.width, contxt.height);
+    initFrameFences(&contxt.fences, CAROUSEL_FRAMES_IN_FLIGHT);
 
     Shader ourShader("../src/11.carousel_gles.vs", "../src/11.carousel_gles.fs");
     contxt.programObject = ourShader.get_id();
 
-    contxt.bmaps.push_back(createBitmap(&contxt, "../img/sky.jpg"));
-    contxt.bmaps.push_back(createBitmap(&contxt, "../img/glitch.jpg"));
-    contxt.bmaps.push_back(createBitmap(&contxt, "../img/sky.jpg"));
-
-    GLfloat pos_x = -1.5f;
-    GLfloat pos_z = 0.0f;
-    for (Bitmap* bmap : contxt.bmaps)
-    {
-        moveRect(bmap, pos_x, 0.0f, pos_z);  // Window spans [-2:2],[-1:1] due to Perspective()
-        pos_x += 0.7f;
-        pos_z += 0.9f;
-    }
+    // every card draws the same unit quad, scaled and moved by uniforms
+    GLfloat *vertices;
+    GLuint *indices;
+    int numIndices = generateRect(1.0, &vertices, &indices);
+
+    // positions fit in [-1, 1]: 8 bytes per vertex instead of 20
+    VertexFormat format;
+    addVertexElement(&format, "v_position", -1, 3, GL_SHORT, GL_TRUE);
+    addVertexElement(&format, "a_texCoord", -1, 2, GL_UNSIGNED_BYTE, GL_TRUE);
+    resolveVertexFormat(&format, contxt.programObject);
+    contxt.quad = createEncodedMesh(&contxt.buffers, &format, vertices, 4,
+                                    indices, numIndices, GL_STATIC_DRAW);
+    free(vertices);
+    free(indices);
+
+    initSpriteBatch(&contxt.batch, &contxt.buffers, contxt.programObject);
+    contxt.programs.push_back(createCardProgram(contxt.programObject));
+
+    // descriptors only, alternating between the sample images
+    Carousel *carousel = &contxt.carousel;
+    carousel->images.push_back("../img/sky.jpg");
+    carousel->images.push_back("../img/glitch.jpg");
+    for (int i = 0; i < numItems; i++)
+        carousel->items.push_back(i % carousel->images.size());
+    contxt.textures.assign(carousel->images.size(), NULL);
+    initObjectPool(&contxt.textureEntries, OBJECT_POOL_PAGE_OBJECTS);
+    carousel->target = carousel->scroll = carousel->previousScroll = std::min(1, numItems - 1);
+    initAnimationClock(&contxt.clock, 60.0);
 
     glViewport(0, 0, contxt.width, contxt.height);
 
+    // draws are reordered by state, the depth test keeps nearer cards in front
+    cacheEnable(GL_DEPTH_TEST, true);
+
+    // the simulation thread lays the cards out, the input thread reads X
+    // events on its own connection, this one owns GL and the EGL connection
+    initTripleBuffer(&contxt.snapshots);
+    initFrameWakeup(&contxt.scheduler);
+    if (!startInputThread(&contxt.input, (Window) contxt.hWnd, CAROUSEL_INPUT_EVENTS,
+                          &contxt.scheduler) && contxt.x_display != NULL)
+        std::cout << "No input thread, the window won't take input" << std::endl;
+    publishCarousel(&contxt, 0.0, false);
+    // golden images simulate on this thread, a fixed step per frame
+    if (!goldenTest.enabled)
+        contxt.simulation = std::thread(simulateCarousel, &contxt);
+    // the window caps the queue, threads past its slices would only idle
+    numWorkers = std::min(numWorkers, CAROUSEL_MAX_CARDS / CARD_SLICE_MIN_DRAWS - 1);
+    initWorkerPool(&contxt.workers, contxt.batched ? 0 : numWorkers);
+
     while (userInterrupt(&contxt) == GL_FALSE)
     {
-        glClear(GL_COLOR_BUFFER_BIT);
+        if (goldenTest.enabled)
+        {
+            goldenTime += GOLDEN_TIME_STEP;
+            advanceCarousel(&contxt, GOLDEN_TIME_STEP, goldenTime, &goldenMoving);
+        }
+        if (acquireTripleBuffer(&contxt.snapshots))
+        {
+            applySnapshot(&contxt, &contxt.frames[tripleBufferReadSlot(&contxt.snapshots)]);
+            requestFrame(&contxt.scheduler);
+        }
+        const FrameSnapshot *snapshot = &contxt.frames[tripleBufferReadSlot(&contxt.snapshots)];
+
+        // blend the snapshot's two ticks by the time since it was simulated
+        double now = goldenTest.enabled ? goldenTime : std::chrono::duration<double>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        float alpha = std::min(1.0, (now - snapshot->tickTime) / contxt.clock.step);
+
+        // past the last tick there is nothing new to show until the next one
+        setAnimating(&contxt.scheduler, snapshot->moving && alpha < 1.0f);
+        if (!beginFrame(&contxt.scheduler))
+        {
+            waitForEvents(&contxt.scheduler, contxt.x_display, -1);
+            continue;
+        }
+        beginGLStateFrame();
+        waitFrameSlot(&contxt.fences);
+
+        layoutCards(&contxt, snapshot, alpha);
 
         ourShader.use();
 
         updateView(&contxt);
+        cullCards(&contxt);
+
+        // clear and draw only where cards moved, skip the frame if none did
+        int damaged = beginDamagedFrame(&contxt.damage);
+        if (damaged == 0)
+            continue;
 
-        for (Bitmap* bmap : contxt.bmaps)
+        for (int i = 0; i < damaged; i++)
         {
-            drawBitmap(&contxt, bmap);
+            const DamageRect *area = scissorDamage(&contxt.damage, i);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            drawBitmaps(&contxt, area);
         }
 
-        eglSwapBuffers(contxt.eglDisplay, contxt.eglSurface);
+        swapDamagedBuffers(&contxt.damage);
+        fenceFrame(&contxt.fences);
     }
 
-    return 0;
+    int status = goldenTest.enabled ? finishGoldenTest(contxt.width, contxt.height) : 0;
+
+    {
+        std::lock_guard<std::mutex> lock(contxt.inputMutex);
+        contxt.running = false;
+        contxt.inputChanged.notify_one();
+    }
+    if (contxt.simulation.joinable())
+        contxt.simulation.join();
+    destroyWorkerPool(&contxt.workers);
+    stopInputThread(&contxt.input);
+    destroyFrameFences(&contxt.fences);
+    destroyFrameScheduler(&contxt.scheduler);
+
+    std::cout << "Carousel: " << numItems << " items, at most " << carousel->peakCards
+              << " cards and " << carousel->peakTextures << " textures resident" << std::endl;
+
+    RenderStats *totals = &contxt.totals;
+    int binds = totals->programBinds + totals->textureBinds;
+    int naiveBinds = totals->naiveProgramBinds + totals->naiveTextureBinds;
+    std::cout << "Render queue: " << totals->draws << " draws, " << binds
+              << " program and texture binds, " << naiveBinds - binds
+              << " saved versus submission order" << std::endl;
+
+    DamageTracker *damage = &contxt.damage;
+    if (damage->pixelsTotal > 0)
+        std::cout << "Damage: repainted " << 100 * damage->pixelsRepainted / damage->pixelsTotal
+                  << "% and presented " << 100 * damage->pixelsPresented / damage->pixelsTotal
+                  << "% of the pixels of full frames" << std::endl;
+
+    if (contxt.inputEvents > 0)
+        std::cout << "Input: " << contxt.inputEvents << " events, queued "
+                  << 1000.0 * contxt.inputDelay / contxt.inputEvents << " ms on average and "
+                  << 1000.0 * contxt.maxInputDelay << " ms at most" << std::endl;
+
+    FrameFences *fences = &contxt.fences;
+    if (fences->depth > 0 && fences->frames > 0)
+        std::cout << "Frame fences: " << fences->depth << " frames in flight, waited "
+                  << 1000.0 * fences->totalWait / fences->frames << " ms per frame on average and "
+                  << 1000.0 * fences->maxWait << " ms at most" << std::endl;
+
+    beginGLStateFrame();
+    GLStateStats *state = &glState.total;
+    if (glState.frames > 0)
+        std::cout << "GL state: " << state->issued / glState.frames << " calls issued and "
+                  << state->filtered / glState.frames << " filtered per frame" << std::endl;
+
+    for (const CarouselCard &live : carousel->live)
+        destroyBitmap(&contxt, live.card, live.image);
+    carousel->live.clear();
+    if (!contxt.freeTextures.empty())
+        cacheDeleteTextures(contxt.freeTextures.size(), &contxt.freeTextures[0]);
+
+    int leaked = destroyObjectPool(&contxt.textureEntries);
+    if (leaked > 0)
+        std::cerr << "Leaked " << leaked << " texture entries" << std::endl;
+
+    destroySpriteBatch(&contxt.batch);
+    destroyMesh(&contxt.quad);
+    destroyBuffers(&contxt.buffers);
+
+    return status;
 }
@@ -1,8 +1,9 @@
 precision mediump float;
 varying vec2 v_texCoord;
+varying vec4 v_color;
 uniform sampler2D s_texture;
 
 void main()
 {
-    gl_FragColor = texture2D(s_texture, v_texCoord);
+    gl_FragColor = texture2D(s_texture, v_texCoord) * v_color;
 }
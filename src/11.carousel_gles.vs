@@ -1,6 +1,7 @@
 uniform float xOffset;
 uniform float yOffset;
 uniform float zOffset;
+uniform float scale;
 
 uniform mat4 model;
 uniform mat4 view;
@@ -8,13 +9,15 @@ uniform mat4 projection;
 
 attribute vec4 v_position;
 attribute vec2 a_texCoord;
+attribute vec4 a_color;
 
 varying vec2 v_texCoord;
+varying vec4 v_color;
 
 void main()
 {
     gl_Position = projection * view * model *
-                  vec4(v_position.x + xOffset, v_position.y + yOffset,
-                       v_position.z + zOffset, 1.0f);
+                  vec4(v_position.xyz * scale + vec3(xOffset, yOffset, zOffset), 1.0);
     v_texCoord = a_texCoord;
+    v_color = a_color;
 }
@@ -4,6 +4,7 @@
 #include <GLFW/glfw3.h>
 
 #include <shader.h>
+#include <window_glfw.h>
 
 const GLuint WIDTH = 800, HEIGHT = 600;
 
@@ -44,7 +45,7 @@ int main()
         glfwTerminate();
         return -1;
     }
-    glfwMakeContextCurrent(window);
+    makeWindowCurrent(window);
 
     glfwSetKeyCallback(window, processInput);
 
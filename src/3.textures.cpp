@@ -4,6 +4,7 @@
 #include <GLFW/glfw3.h>
 
 #include <shader.h>
+#include <window_glfw.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -48,7 +49,7 @@ int main()
         glfwTerminate();
         return -1;
     }
-    glfwMakeContextCurrent(window);
+    makeWindowCurrent(window);
     glfwSetKeyCallback(window, processInput);
 
     glewExperimental = GL_TRUE;
@@ -171,9 +172,10 @@ int main()
         glDrawArrays(GL_TRIANGLES, 0, 3);
         glBindVertexArray(0);
 
-        // Swap back buffer to front, and check events
+        // Swap back buffer to front, then sleep until an event changes
+        // something: nothing on screen moves by itself
         glfwSwapBuffers(window);
-        glfwPollEvents();
+        glfwWaitEvents();
     }
 
     // Deallocate all resources once they've outlived their purpose:
@@ -8,6 +8,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <shader.h>
+#include <window_glfw.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -52,7 +53,7 @@ int main()
         glfwTerminate();
         return -1;
     }
-    glfwMakeContextCurrent(window);
+    makeWindowCurrent(window);
     glfwSetKeyCallback(window, processInput);
 
     glewExperimental = GL_TRUE;
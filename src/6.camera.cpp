@@ -1,4 +1,8 @@
+#include <algorithm>
 #include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
@@ -7,6 +11,10 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <shader.h>
+#include <window_glfw.h>
+#include <vertex_format.h>
+#include <instanced_mesh.h>
+#include <frame_fence.h>
 
 #include <SDL.h>
 #include <SDL_image.h>
@@ -34,12 +42,41 @@ float lastX =  800.0f / 2.0;
 float lastY =  600.0 / 2.0;
 float fov   =  45.0f;
 
+// Late latching: the camera is set from the newest input right before the
+// draws that use it are issued, everything else in the frame goes first.
+// inputTime is when GLFW delivered the oldest input no frame has used yet.
+#define CAMERA_BLOCK_BINDING 0
+
+bool inputPending = false;
+double inputTime = 0.0;
+
+// --latency: times of the frames that carried input, present is approximated
+// by a glFinish() after the swap
+typedef struct _latencyStats
+{
+    bool enabled;
+    int frames;
+    double toLatch;
+    double toPresent;
+    double maxToPresent;
+} LatencyStats;
+
+LatencyStats latency = {};
+
+void noteInput()
+{
+    if (!inputPending)
+        inputTime = glfwGetTime();
+    inputPending = true;
+}
+
 // process all input
 // query GLFW whether relevant keys are pressed/released this frame and react accordingly
 void processInput(GLFWwindow *window, int key, int scancode, int action, int mode)
 {
     float cameraSpeed = 5.0f * deltaTime;
 
+    noteInput();
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, GL_TRUE);
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
@@ -55,6 +92,8 @@ void processInput(GLFWwindow *window, int key, int scancode, int action, int mod
 // whenever the mouse moves, this callback is called
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 {
+    noteInput();
+
     // avoid jumping when first receiving focus of mouse cursor
     if (firstMouse)
     {
@@ -91,6 +130,7 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 // whenever the mouse moves, this callback is called
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
+    noteInput();
     if (fov >= 1.0f && fov <= 45.0f)
         fov -= yoffset;
     if (fov <= 1.0f)
@@ -108,12 +148,38 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     glViewport(0, 0, width, height);
 }
 
-int main()
+// Picks up the input delivered since the last poll and writes the camera
+// block. Returns when the oldest input it applied arrived, -1 for none.
+double latchCamera(GLuint cameraBuffer)
 {
-    GLuint VBO_T, VAO_T, EBO_T, VBO_F, VAO_F, EBO_F;
+    glfwPollEvents();
+
+    glm::mat4 camera[2];
+    camera[0] = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+    camera[1] = glm::perspective(glm::radians(fov),
+                                 (GLfloat)WIDTH / (GLfloat)HEIGHT, 0.1f, 100.0f);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(camera), glm::value_ptr(camera[0]));
+
+    double latched = inputPending ? inputTime : -1.0;
+    inputPending = false;
+    return latched;
+}
+
+int main(int argc, char *argv[])
+{
+    GLuint VAO_T, VBO_F, VAO_F, EBO_F;
 
     std::cout << "Starting GLFW context, OpenGL 3.3" << std::endl;
 
+    // --latency reports input to present times, it waits for every frame
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--latency") == 0)
+            latency.enabled = true;
+    }
+
     // Init GLFW
     glfwInit();
 
@@ -129,7 +195,7 @@ int main()
         glfwTerminate();
         return -1;
     }
-    glfwMakeContextCurrent(window);
+    makeWindowCurrent(window);
     glfwSetKeyCallback(window, processInput);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
@@ -140,6 +206,10 @@ int main()
     glewExperimental = GL_TRUE;
     glewInit();
 
+    // at most two frames queued ahead of the GPU
+    FrameFences fences;
+    initFrameFences(&fences, 2);
+
     int numAttributes;
     glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &numAttributes);
     std::cout << "Maximum num of vertex attributes supported: " << numAttributes << std::endl;
@@ -150,9 +220,20 @@ int main()
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
     // Build our shader program
-    Shader tetraShader("../src/6.camera.vs", "../src/6.camera.fs");
+    Shader tetraShader("../src/6.camera_instanced.vs", "../src/6.camera.fs");
     Shader floorShader("../src/6.camera.vs", "../src/6.camera.fs2");
 
+    // view and projection, shared by both programs
+    GLuint cameraBuffer;
+    glGenBuffers(1, &cameraBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, cameraBuffer);
+    glUniformBlockBinding(tetraShader.ID, glGetUniformBlockIndex(tetraShader.ID, "Camera"),
+                          CAMERA_BLOCK_BINDING);
+    glUniformBlockBinding(floorShader.ID, glGetUniformBlockIndex(floorShader.ID, "Camera"),
+                          CAMERA_BLOCK_BINDING);
+
     GLfloat tetra_vertices[] = {
         // positions         // texture coords
         -0.5f, 0.5f, 0.0f,   0.0f, 0.0f,  // top left
@@ -168,7 +249,7 @@ int main()
          100.0f, -0.5f,  100.0f
     };
 
-    GLint tetra_indices[] = {
+    GLushort tetra_indices[] = {
         0, 1, 2,   // front
         1, 2, 3,   // right
         0, 2, 3,   // left
@@ -237,40 +318,52 @@ int main()
 
     // Bind vertex array object, and set vertex buffer(s) and attribute pointer(s)
     glGenVertexArrays(1, &VAO_T);
-    glGenBuffers(1, &VBO_T);
-    glGenBuffers(1, &EBO_T);
     glGenVertexArrays(1, &VAO_F);
     glGenBuffers(1, &VBO_F);
     glGenBuffers(1, &EBO_F);
 
     glBindVertexArray(VAO_T);
 
-    // Copy our vertices array in a buffer for OpenGL to use
-    glBindBuffer(GL_ARRAY_BUFFER, VBO_T);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(tetra_vertices), tetra_vertices, GL_STATIC_DRAW);
+    // Half float positions and normalized byte texture coords, 8 bytes per
+    // vertex instead of 20
+    VertexFormat tetraFormat;
+    addVertexElement(&tetraFormat, "aPos", 0, 3, GL_HALF_FLOAT, GL_FALSE);
+    addVertexElement(&tetraFormat, "aTexCoord", 2, 2, GL_UNSIGNED_BYTE, GL_TRUE);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_T);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(tetra_indices), tetra_indices, GL_STATIC_DRAW);
+    std::vector<unsigned char> tetra_data(4 * tetraFormat.stride);
+    encodeVertices(&tetraFormat, tetra_vertices, 4, &tetra_data[0]);
 
-    // Then set the vertex attributes pointers
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    // Every tetrahedron is drawn by one instanced draw. INSTANCING=uniform
+    // forces the uniform array fallback used where instancing is missing.
+    InstancingApi instancing = coreInstancingApi();
+    const char *instancingMode = getenv("INSTANCING");
+    if (instancingMode != NULL && strcmp(instancingMode, "uniform") == 0)
+    {
+        instancing.vertexAttribDivisor = NULL;
+        instancing.drawElementsInstanced = NULL;
+    }
 
-    // texture coord attribute
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+    InstancedMesh tetra;
+    initInstancedMesh(&tetra, &instancing, &tetraFormat, &tetra_data[0], 4,
+                      tetra_indices, 12, tetraShader.ID, 3);
+    std::cout << "Tetrahedra instancing: "
+              << (tetra.hardware ? "hardware" : "uniform array") << std::endl;
 
     // Set floor
     glBindVertexArray(VAO_F);
 
+    VertexFormat floorFormat;
+    addVertexElement(&floorFormat, "aPos", 0, 3, GL_HALF_FLOAT, GL_FALSE);
+
+    std::vector<unsigned char> floor_data(4 * floorFormat.stride);
+    encodeVertices(&floorFormat, floor_vertices, 4, &floor_data[0]);
+
     glBindBuffer(GL_ARRAY_BUFFER, VBO_F);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(floor_vertices), floor_vertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, floor_data.size(), &floor_data[0], GL_STATIC_DRAW);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_F);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(floor_indices), floor_indices, GL_STATIC_DRAW);
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+    applyVertexFormat(&floorFormat, 0);
 
     // Unbind VAO
     glBindVertexArray(0);
@@ -282,6 +375,12 @@ int main()
         glm::vec3( 2.0f,  0.0f, -5.0f),
     };
 
+    // The tetrahedra don't move, upload their transforms once
+    std::vector<glm::mat4> models;
+    for (const glm::vec3 &position : cubePositions)
+        models.push_back(glm::translate(glm::mat4(), position));
+    setInstanceTransforms(&tetra, glm::value_ptr(models[0]), models.size());
+
     // We can set this to GL_LINE to use wireframe mode
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
@@ -292,8 +391,13 @@ int main()
         // per-frame time logic
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
+        // frames only follow events, a long wait for one isn't a time step
+        if (deltaTime > 0.1f)
+            deltaTime = 0.1f;
         lastFrame = currentFrame;
 
+        waitFrameSlot(&fences);
+
         // Rendering commands here
         glClearColor(0.0f, 0.0f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -301,64 +405,66 @@ int main()
         // Bind our texture
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, texture);
-        glUniform1i(glGetUniformLocation(tetraShader.ID, "ourTexture"), 0);
-
-        glm::mat4 view;
-        glm::mat4 projection;
 
-        view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-        projection = glm::perspective(glm::radians(fov),
-                                      (GLfloat)WIDTH / (GLfloat)HEIGHT, 0.1f, 100.0f);
+        // everything that doesn't depend on the camera goes first
+        glm::mat4 model;
+        floorShader.use();
+        glUniformMatrix4fv(glGetUniformLocation(floorShader.ID, "model"), 1, GL_FALSE,
+                           glm::value_ptr(model));
 
-        // Use our shader program when we want to render an object
         tetraShader.use();
+        glUniform1i(glGetUniformLocation(tetraShader.ID, "ourTexture"), 0);
+        glUniform1i(glGetUniformLocation(tetraShader.ID, "uniformInstancing"), !tetra.hardware);
 
-        // Retrieve the matrix uniform locations
-        GLint viewLoc  = glGetUniformLocation(tetraShader.ID, "view");
-        GLint projectLoc = glGetUniformLocation(tetraShader.ID, "projection");
-
-        // Pass them to the shaders
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(projectLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        // then the newest input, and only the draws after it
+        double latchedInput = latchCamera(cameraBuffer);
+        double latchTime = glfwGetTime();
 
         glBindVertexArray(VAO_T);
-
-        GLint modelLoc;
-        for(unsigned int i = 0; i < 4; i++)
-        {
-            // Create transformations
-            glm::mat4 model;
-            model = glm::translate(model, cubePositions[i]);
-            modelLoc = glGetUniformLocation(tetraShader.ID, "model");
-            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-            glDrawElements(GL_TRIANGLES, 12, GL_UNSIGNED_INT, 0);
-        }
+        drawInstancedMesh(&tetra);
 
         floorShader.use();
         glBindVertexArray(VAO_F);
-
-        glm::mat4 model;
-        modelLoc = glGetUniformLocation(floorShader.ID, "model");
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(projectLoc, 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
         glBindVertexArray(0);
 
-        // Swap back buffer to front, and check events
+        // Swap back buffer to front, then sleep until an event changes
+        // something: nothing on screen moves by itself
         glfwSwapBuffers(window);
-        glfwPollEvents();
+        fenceFrame(&fences);
+
+        if (latency.enabled && latchedInput >= 0.0)
+        {
+            glFinish();
+            double toPresent = glfwGetTime() - latchedInput;
+            latency.frames++;
+            latency.toLatch += latchTime - latchedInput;
+            latency.toPresent += toPresent;
+            latency.maxToPresent = std::max(latency.maxToPresent, toPresent);
+        }
+
+        glfwWaitEvents();
     }
 
+    destroyFrameFences(&fences);
+    if (fences.depth > 0 && fences.frames > 0)
+        std::cout << "Frame fences: " << fences.depth << " frames in flight, waited "
+                  << 1000.0 * fences.totalWait / fences.frames << " ms per frame on average and "
+                  << 1000.0 * fences.maxWait << " ms at most" << std::endl;
+
+    if (latency.frames > 0)
+        std::cout << "Latency: " << latency.frames << " frames with input, input to camera "
+                  << 1000.0 * latency.toLatch / latency.frames << " ms and input to present "
+                  << 1000.0 * latency.toPresent / latency.frames << " ms on average, "
+                  << 1000.0 * latency.maxToPresent << " ms at most" << std::endl;
+
     // Deallocate all resources once they've outlived their purpose:
     glDeleteVertexArrays(1, &VAO_T);
-    glDeleteBuffers(1, &EBO_T);
-    glDeleteBuffers(1, &VBO_T);
+    destroyInstancedMesh(&tetra);
     glDeleteVertexArrays(1, &VAO_F);
     glDeleteBuffers(1, &VBO_F);
     glDeleteBuffers(1, &EBO_F);
+    glDeleteBuffers(1, &cameraBuffer);
 
     glfwTerminate();
 
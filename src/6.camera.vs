@@ -5,8 +5,12 @@ layout (location = 2) in vec2 aTexCoord;  // the texture coordinates has attribu
 out vec2 TexCoord;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// written once per frame, right before the draws
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+};
 
 void main()
 {
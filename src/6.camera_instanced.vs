@@ -0,0 +1,24 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;  // position variable has attribute position 0
+layout (location = 1) in float aInstance;  // copy index, uniform array fallback only
+layout (location = 2) in vec2 aTexCoord;  // the texture coordinates has attribute position 2
+layout (location = 3) in mat4 aInstanceModel;  // per instance, takes locations 3 to 6
+
+out vec2 TexCoord;
+
+uniform mat4 instanceModels[32];
+uniform bool uniformInstancing;
+// written once per frame, right before the draws
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+};
+
+void main()
+{
+    mat4 model = uniformInstancing ? instanceModels[int(aInstance)] : aInstanceModel;
+
+    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+    TexCoord = vec2(aTexCoord.x, aTexCoord.y);
+}
@@ -8,6 +8,9 @@
 #include <sstream>
 
 #include <shader_gles.h>
+#include <frame_scheduler.h>
+#include <headless_egl.h>
+#include <golden_image.h>
 
 #define ES_WINDOW_RGB           0
 #define ES_WINDOW_ALPHA         1
@@ -28,6 +31,8 @@ typedef struct _context
     EGLContext  eglContext;
     EGLSurface  eglSurface;
 
+    FrameScheduler scheduler;
+
 } Context;
 
 EGLBoolean WinCreate(Context *contxt, const char *title)
@@ -147,6 +152,15 @@ GLboolean esCreateWindow(Context *contxt, const char* title, GLuint flags)
     if (contxt == NULL)
         return GL_FALSE;
 
+    if (headlessRequested())
+    {
+        contxt->x_display = NULL;
+        contxt->hWnd = (EGLNativeWindowType) 0;
+        return createHeadlessContext(attribList, contxt->width, contxt->height,
+                                     &contxt->eglDisplay, &contxt->eglContext,
+                                     &contxt->eglSurface) ? GL_TRUE : GL_FALSE;
+    }
+
     if (!WinCreate (contxt, title))
         return GL_FALSE;
 
@@ -169,6 +183,9 @@ GLboolean userInterrupt(Context *contxt)
     GLboolean userinterrupt = GL_FALSE;
     char text;
 
+    if (contxt->x_display == NULL)
+        return headlessFinished() ? GL_TRUE : GL_FALSE;
+
     while (XPending(contxt->x_display)) {
         XNextEvent(contxt->x_display, &xev);
         if (xev.type == KeyPress) {
@@ -176,6 +193,9 @@ GLboolean userInterrupt(Context *contxt)
             }
         }
 
+        if (xev.type == Expose)
+            requestFrame(&contxt->scheduler);
+
         if (xev.type == DestroyNotify)
             userinterrupt = GL_TRUE;
     }
@@ -186,7 +206,9 @@ GLboolean userInterrupt(Context *contxt)
 int main(int argc, char *argv[])
 {
     Context contxt;
+    initGoldenTest(argc, argv, "gles");
     esCreateWindow (&contxt, "GLES", ES_WINDOW_RGB);
+    initFrameScheduler(&contxt.scheduler, contxt.eglDisplay, 1);
 
     Shader ourShader("../src/7.opengles.vs", "../src/7.opengles.fs");
 
@@ -199,6 +221,13 @@ int main(int argc, char *argv[])
 
     while (userInterrupt(&contxt) == GL_FALSE)
     {
+        // nothing changed since the last frame, sleep until X has events
+        if (!beginFrame(&contxt.scheduler))
+        {
+            waitForEvents(&contxt.scheduler, contxt.x_display, -1);
+            continue;
+        }
+
         glClear(GL_COLOR_BUFFER_BIT);
 
         ourShader.use();
@@ -211,5 +240,5 @@ int main(int argc, char *argv[])
         eglSwapBuffers(contxt.eglDisplay, contxt.eglSurface);
     }
 
-    return 0;
+    return goldenTest.enabled ? finishGoldenTest(contxt.width, contxt.height) : 0;
 }
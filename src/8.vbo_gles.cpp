@@ -8,6 +8,10 @@
 #include <sstream>
 
 #include <shader_gles.h>
+#include <buffer_gles.h>
+#include <frame_scheduler.h>
+#include <headless_egl.h>
+#include <golden_image.h>
 
 #define ES_WINDOW_RGB           0
 #define ES_WINDOW_ALPHA         1
@@ -15,23 +19,14 @@
 #define ES_WINDOW_STENCIL       4
 #define ES_WINDOW_MULTISAMPLE   8
 
-#define VERTEX_POS_SIZE         3
-#define VERTEX_NORMAL_SIZE      3
-#define VERTEX_TEXCOORD0_SIZE   2
-
-#define VERTEX_POS_INDX         0
-#define VERTEX_NORMAL_INDX      1
-#define VERTEX_TEXCOORD0_INDX   2
-
 typedef struct _context
 {
     GLuint programObject;
 
     GLint positionLoc;
 
-    GLfloat *vertices;
-    GLuint *indices;
-    int numIndices;
+    BufferManager buffers;
+    Mesh rect;
 
     GLint width = 320;
     GLint height = 240;
@@ -42,6 +37,8 @@ typedef struct _context
     EGLContext  eglContext;
     EGLSurface  eglSurface;
 
+    FrameScheduler scheduler;
+
 } Context;
 
 int generateRect(float scale, GLfloat **vertices, GLuint **indices)
@@ -200,6 +197,15 @@ GLboolean esCreateWindow(Context *contxt, const char* title, GLuint flags)
     if (contxt == NULL)
         return GL_FALSE;
 
+    if (headlessRequested())
+    {
+        contxt->x_display = NULL;
+        contxt->hWnd = (EGLNativeWindowType) 0;
+        return createHeadlessContext(attribList, contxt->width, contxt->height,
+                                     &contxt->eglDisplay, &contxt->eglContext,
+                                     &contxt->eglSurface) ? GL_TRUE : GL_FALSE;
+    }
+
     if (!WinCreate (contxt, title))
         return GL_FALSE;
 
@@ -222,6 +228,9 @@ GLboolean userInterrupt(Context *contxt)
     GLboolean userinterrupt = GL_FALSE;
     char text;
 
+    if (contxt->x_display == NULL)
+        return headlessFinished() ? GL_TRUE : GL_FALSE;
+
     while (XPending(contxt->x_display)) {
         XNextEvent(contxt->x_display, &xev);
         if (xev.type == KeyPress) {
@@ -229,6 +238,9 @@ GLboolean userInterrupt(Context *contxt)
             }
         }
 
+        if (xev.type == Expose)
+            requestFrame(&contxt->scheduler);
+
         if (xev.type == DestroyNotify)
             userinterrupt = GL_TRUE;
     }
@@ -239,30 +251,51 @@ GLboolean userInterrupt(Context *contxt)
 int main(int argc, char *argv[])
 {
     Context contxt;
+    initGoldenTest(argc, argv, "vbo_gles");
     esCreateWindow (&contxt, "GLES", ES_WINDOW_RGB);
+    initFrameScheduler(&contxt.scheduler, contxt.eglDisplay, 1);
 
     Shader ourShader("../src/8.vbo_gles.vs", "../src/8.vbo_gles.fs");
     contxt.programObject = ourShader.get_id();
 
     contxt.positionLoc = glGetAttribLocation(contxt.programObject, "v_position");
-    contxt.numIndices = generateRect(0.8, &contxt.vertices, &contxt.indices);
+
+    GLfloat *vertices;
+    GLuint *indices;
+    int numIndices = generateRect(0.8, &vertices, &indices);
+
+    // 8 bytes per vertex instead of 12
+    VertexFormat format;
+    addVertexElement(&format, "v_position", contxt.positionLoc, 3, GL_SHORT, GL_TRUE);
+    contxt.rect = createEncodedMesh(&contxt.buffers, &format, vertices, 4,
+                                    indices, numIndices, GL_STATIC_DRAW);
+    free(vertices);
+    free(indices);
 
     glViewport(0, 0, contxt.width, contxt.height);
 
     while (userInterrupt(&contxt) == GL_FALSE)
     {
+        // nothing changed since the last frame, sleep until X has events
+        if (!beginFrame(&contxt.scheduler))
+        {
+            waitForEvents(&contxt.scheduler, contxt.x_display, -1);
+            continue;
+        }
+
         glClear ( GL_COLOR_BUFFER_BIT );
 
         ourShader.use();
 
-        glVertexAttribPointer(contxt.positionLoc, 3, GL_FLOAT,
-                              GL_FALSE, 3 * sizeof(GLfloat), contxt.vertices);
-        glEnableVertexAttribArray (contxt.positionLoc);
-
-        glDrawElements(GL_TRIANGLES, contxt.numIndices, GL_UNSIGNED_INT, contxt.indices);
+        drawMesh(&contxt.rect);
 
         eglSwapBuffers(contxt.eglDisplay, contxt.eglSurface);
     }
 
-    return 0;
+    int status = goldenTest.enabled ? finishGoldenTest(contxt.width, contxt.height) : 0;
+
+    destroyMesh(&contxt.rect);
+    destroyBuffers(&contxt.buffers);
+
+    return status;
 }
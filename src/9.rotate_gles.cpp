@@ -4,11 +4,17 @@
 #include <stdlib.h>
 #include <iostream>
 #include <string.h>
+#include <chrono>
 #include <fstream>
 #include <sstream>
 
 #include <shader_gles.h>
+#include <buffer_gles.h>
 #include <matrix_gles.h>
+#include <animation.h>
+#include <frame_scheduler.h>
+#include <headless_egl.h>
+#include <golden_image.h>
 
 #define ES_WINDOW_RGB           0
 #define ES_WINDOW_ALPHA         1
@@ -16,14 +22,6 @@
 #define ES_WINDOW_STENCIL       4
 #define ES_WINDOW_MULTISAMPLE   8
 
-#define VERTEX_POS_SIZE         3
-#define VERTEX_NORMAL_SIZE      3
-#define VERTEX_TEXCOORD0_SIZE   2
-
-#define VERTEX_POS_INDX         0
-#define VERTEX_NORMAL_INDX      1
-#define VERTEX_TEXCOORD0_INDX   2
-
 typedef struct _context
 {
     GLuint programObject;
@@ -36,11 +34,13 @@ typedef struct _context
 
     GLint mvpLoc;
     Matrix mvpMatrix;
-    GLfloat angle;
 
-    GLfloat *vertices;
-    GLuint *indices;
-    int numIndices;
+    AnimationClock clock;
+    AnimationTracks tracks;
+    int spin;                   // rotation angle track, degrees
+
+    BufferManager buffers;
+    Mesh rect;
 
     GLint width = 320;
     GLint height = 240;
@@ -51,6 +51,8 @@ typedef struct _context
     EGLContext  eglContext;
     EGLSurface  eglSurface;
 
+    FrameScheduler scheduler;
+
 } Context;
 
 
@@ -69,7 +71,7 @@ GLuint createTexture()
    glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
 
    glGenTextures(1, &textureId);
-   glBindTexture(GL_TEXTURE_2D, textureId);
+   cacheBindTexture(textureId);
    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 2, 2, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
 
    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -234,6 +236,15 @@ GLboolean esCreateWindow(Context *contxt, const char* title, GLuint flags)
     if (contxt == NULL)
         return GL_FALSE;
 
+    if (headlessRequested())
+    {
+        contxt->x_display = NULL;
+        contxt->hWnd = (EGLNativeWindowType) 0;
+        return createHeadlessContext(attribList, contxt->width, contxt->height,
+                                     &contxt->eglDisplay, &contxt->eglContext,
+                                     &contxt->eglSurface) ? GL_TRUE : GL_FALSE;
+    }
+
     if (!WinCreate (contxt, title))
         return GL_FALSE;
 
@@ -256,6 +267,9 @@ GLboolean userInterrupt(Context *contxt)
     GLboolean userinterrupt = GL_FALSE;
     char text;
 
+    if (contxt->x_display == NULL)
+        return headlessFinished() ? GL_TRUE : GL_FALSE;
+
     while (XPending(contxt->x_display)) {
         XNextEvent(contxt->x_display, &xev);
         if (xev.type == KeyPress) {
@@ -263,6 +277,9 @@ GLboolean userInterrupt(Context *contxt)
             }
         }
 
+        if (xev.type == Expose)
+            requestFrame(&contxt->scheduler);
+
         if (xev.type == DestroyNotify)
             userinterrupt = GL_TRUE;
     }
@@ -270,15 +287,21 @@ GLboolean userInterrupt(Context *contxt)
     return userinterrupt;
 }
 
-void updateRect(Context* contxt)
+// Runs the ticks owed for deltaTime, then builds the matrix for the
+// moment between the last two ticks that this frame shows
+void updateRect(Context* contxt, float deltaTime)
 {
     Matrix perspective;
     Matrix modelview;
     float aspect;
+    float angle;
 
-    contxt->angle += 2;
-    if (contxt->angle >= 360.0f)
-        contxt->angle -= 360.0f;
+    int ticks = advanceAnimationClock(&contxt->clock, deltaTime);
+    for (int i = 0; i < ticks; i++)
+        stepTracks(&contxt->tracks, nextAnimationTick(&contxt->clock));
+
+    angle = fmodf(sampleTrack(&contxt->tracks, contxt->spin, animationAlpha(&contxt->clock)),
+                  360.0f);
 
     aspect = (GLfloat) contxt->width / (GLfloat) contxt->height;
 
@@ -286,7 +309,7 @@ void updateRect(Context* contxt)
     Perspective(&perspective, 60.0f, aspect, 1.0f, 20.0f);
     MatrixLoadIdentity(&modelview);
     Translate(&modelview, 0.0, 0.0, -2.0);
-    Rotate(&modelview, contxt->angle, 1.0, 0.0, 1.0);
+    Rotate(&modelview, angle, 1.0, 0.0, 1.0);
     MatrixMultiply(&contxt->mvpMatrix, &modelview, &perspective);
 }
 
@@ -294,7 +317,9 @@ int main(int argc, char *argv[])
 {
     Context contxt;
 
+    initGoldenTest(argc, argv, "rotate_gles");
     esCreateWindow (&contxt, "GLES", ES_WINDOW_RGB);
+    initFrameScheduler(&contxt.scheduler, contxt.eglDisplay, 1);
 
     Shader ourShader("../src/9.rotate_gles.vs", "../src/9.rotate_gles.fs");
     contxt.programObject = ourShader.get_id();
@@ -304,39 +329,63 @@ int main(int argc, char *argv[])
 
     contxt.samplerLoc = glGetUniformLocation(contxt.programObject, "s_texture");
 
-    contxt.numIndices = generateRect(0.8, &contxt.vertices, &contxt.indices);
+    GLfloat *vertices;
+    GLuint *indices;
+    int numIndices = generateRect(0.8, &vertices, &indices);
+
+    // positions fit in [-1, 1]: 8 bytes per vertex instead of 20
+    VertexFormat format;
+    addVertexElement(&format, "v_position", contxt.positionLoc, 3, GL_SHORT, GL_TRUE);
+    addVertexElement(&format, "a_texCoord", contxt.texCoordLoc, 2, GL_UNSIGNED_BYTE, GL_TRUE);
+    contxt.rect = createEncodedMesh(&contxt.buffers, &format, vertices, 4,
+                                    indices, numIndices, GL_STATIC_DRAW);
+    free(vertices);
+    free(indices);
+
     contxt.mvpLoc = glGetUniformLocation(contxt.programObject, "u_mvpMatrix");
-    contxt.angle = 45.0f;
+
+    // from the 45 degrees the sample always started at, a turn every 3
+    // seconds (the old 2 degrees per frame at 60 Hz) whatever the frame rate
+    initAnimationClock(&contxt.clock, 60.0);
+    contxt.spin = addTrack(&contxt.tracks, 45.0f, 405.0f, 0.0, 3.0f,
+                           TRACK_EASE_LINEAR, TRACK_REPEAT);
+    // it never stops turning, frames are only paced by the swap interval
+    setAnimating(&contxt.scheduler, true);
 
     contxt.textureId = createTexture();
 
     glViewport(0, 0, contxt.width, contxt.height);
 
+    std::chrono::steady_clock::time_point lastFrame = std::chrono::steady_clock::now();
     while (userInterrupt(&contxt) == GL_FALSE)
     {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        float deltaTime = std::chrono::duration<float>(now - lastFrame).count();
+        lastFrame = now;
+        // golden images need the same angle on every run
+        if (goldenTest.enabled)
+            deltaTime = GOLDEN_TIME_STEP;
+
         glClear ( GL_COLOR_BUFFER_BIT );
 
-        updateRect(&contxt);
+        updateRect(&contxt, deltaTime);
 
         ourShader.use();
 
-        glVertexAttribPointer(contxt.positionLoc, 3, GL_FLOAT,
-                              GL_FALSE, 5 * sizeof(GLfloat), contxt.vertices);
-        glVertexAttribPointer(contxt.texCoordLoc, 2, GL_FLOAT,
-                              GL_FALSE, 5 * sizeof(GLfloat), contxt.vertices);
-
-        glEnableVertexAttribArray (contxt.positionLoc);
-        glEnableVertexAttribArray (contxt.texCoordLoc);
-
         glUniformMatrix4fv(contxt.mvpLoc, 1, GL_FALSE, (GLfloat*) &contxt.mvpMatrix.m[0][0]);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, contxt.textureId);
+        cacheActiveTexture(GL_TEXTURE0);
+        cacheBindTexture(contxt.textureId);
 
-        glDrawElements(GL_TRIANGLES, contxt.numIndices, GL_UNSIGNED_INT, contxt.indices);
+        drawMesh(&contxt.rect);
 
         eglSwapBuffers(contxt.eglDisplay, contxt.eglSurface);
     }
 
-    return 0;
+    int status = goldenTest.enabled ? finishGoldenTest(contxt.width, contxt.height) : 0;
+
+    destroyMesh(&contxt.rect);
+    destroyBuffers(&contxt.buffers);
+
+    return status;
 }
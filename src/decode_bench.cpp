@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <image_decoder.h>
+
+// Decodes an in-memory copy of the corpus with every compiled-in backend,
+// single- and multi-threaded. Each run happens in a forked child so the peak
+// RSS reported belongs to that backend alone.
+
+typedef struct _corpusFile
+{
+    std::string path;
+    unsigned char *data;
+    size_t size;
+} CorpusFile;
+
+typedef struct _benchResult
+{
+    double seconds;
+    double inputBytes;
+    double outputBytes;
+    int decoded;
+    int failed;
+    std::vector<double> latencies;   // milliseconds
+} BenchResult;
+
+void usage(const char *argv0)
+{
+    printf("usage: %s [-b backend] [-t threads] [-n iterations] [file|dir ...]\n", argv0);
+    printf("backends:");
+    for (int i = 0; i < numImageDecoders; i++)
+        printf(" %s", imageDecoders[i].name);
+    printf("\n");
+}
+
+bool isImageFile(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    if (ext == NULL)
+        return false;
+
+    return strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0 ||
+           strcasecmp(ext, ".png") == 0;
+}
+
+void addCorpusPath(std::vector<CorpusFile> &corpus, const std::string &path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        fprintf(stderr, "Cannot stat %s\n", path.c_str());
+        return;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path.c_str());
+        if (dir == NULL)
+            return;
+
+        std::vector<std::string> names;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (isImageFile(entry->d_name))
+                names.push_back(path + "/" + entry->d_name);
+        }
+        closedir(dir);
+
+        std::sort(names.begin(), names.end());
+        for (const std::string &name : names)
+            addCorpusPath(corpus, name);
+        return;
+    }
+
+    CorpusFile file;
+    file.path = path;
+    file.data = readImageFile(path.c_str(), &file.size);
+    if (file.data == NULL) {
+        fprintf(stderr, "Cannot read %s\n", path.c_str());
+        return;
+    }
+
+    corpus.push_back(file);
+}
+
+long peakRssKb()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+BenchResult runBench(const ImageDecoder *decoder, const std::vector<CorpusFile> &corpus,
+                     int numThreads, int iterations)
+{
+    BenchResult result;
+    int numJobs = (int) corpus.size() * iterations;
+    std::atomic<int> nextJob(0);
+    std::vector<std::vector<double> > latencies(numThreads);
+    std::vector<double> outputBytes(numThreads, 0.0);
+    std::vector<int> failed(numThreads, 0);
+
+    auto worker = [&](int id) {
+        int job;
+        while ((job = nextJob.fetch_add(1)) < numJobs) {
+            const CorpusFile &file = corpus[job % corpus.size()];
+            Image image;
+
+            auto start = std::chrono::steady_clock::now();
+            bool ok = decoder->decode(file.data, file.size, &image);
+            auto end = std::chrono::steady_clock::now();
+
+            latencies[id].push_back(
+                std::chrono::duration<double, std::milli>(end - start).count());
+            if (!ok) {
+                failed[id]++;
+                continue;
+            }
+
+            outputBytes[id] += (double) image.width * image.height * image.channels;
+            decoder->release(&image);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; i++)
+        threads.push_back(std::thread(worker, i));
+    for (std::thread &thread : threads)
+        thread.join();
+    auto end = std::chrono::steady_clock::now();
+
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    result.inputBytes = 0.0;
+    for (int i = 0; i < numJobs; i++)
+        result.inputBytes += corpus[i % corpus.size()].size;
+    result.outputBytes = 0.0;
+    result.failed = 0;
+    for (int i = 0; i < numThreads; i++) {
+        result.outputBytes += outputBytes[i];
+        result.failed += failed[i];
+        result.latencies.insert(result.latencies.end(),
+                                latencies[i].begin(), latencies[i].end());
+    }
+    result.decoded = numJobs - result.failed;
+    std::sort(result.latencies.begin(), result.latencies.end());
+
+    return result;
+}
+
+double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+
+    size_t index = (size_t) (p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void printHeader()
+{
+    printf("%-14s %7s %8s %10s %10s %9s %8s %8s %8s %8s\n",
+           "backend", "threads", "images", "in MB/s", "out MB/s",
+           "peak RSS", "p50 ms", "p90 ms", "p99 ms", "max ms");
+}
+
+void printResult(const ImageDecoder *decoder, int numThreads,
+                 const BenchResult &result, long rssKb)
+{
+    double mb = 1024.0 * 1024.0;
+
+    printf("%-14s %7d %8d %10.1f %10.1f %7ldMB %8.2f %8.2f %8.2f %8.2f",
+           decoder->name, numThreads, result.decoded,
+           result.inputBytes / mb / result.seconds,
+           result.outputBytes / mb / result.seconds,
+           rssKb / 1024, percentile(result.latencies, 50.0),
+           percentile(result.latencies, 90.0), percentile(result.latencies, 99.0),
+           result.latencies.empty() ? 0.0 : result.latencies.back());
+    if (result.failed > 0)
+        printf("  (%d failed)", result.failed);
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *backend = NULL;
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    int iterations = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:t:n:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            backend = optarg;
+            break;
+        case 't':
+            maxThreads = std::max(1, atoi(optarg));
+            break;
+        case 'n':
+            iterations = std::max(1, atoi(optarg));
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    std::vector<CorpusFile> corpus;
+    if (optind == argc)
+        addCorpusPath(corpus, "../img");
+    for (int i = optind; i < argc; i++)
+        addCorpusPath(corpus, argv[i]);
+
+    if (corpus.empty()) {
+        fprintf(stderr, "No images to decode\n");
+        return 1;
+    }
+
+    std::vector<const ImageDecoder *> decoders;
+    for (int i = 0; i < numImageDecoders; i++) {
+        if (backend == NULL || strcmp(backend, imageDecoders[i].name) == 0)
+            decoders.push_back(&imageDecoders[i]);
+    }
+
+    if (decoders.empty()) {
+        fprintf(stderr, "Unknown backend %s\n", backend);
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<int> threadCounts;
+    threadCounts.push_back(1);
+    if (maxThreads > 1)
+        threadCounts.push_back(maxThreads);
+
+    printf("Corpus: %zu files, %d iterations, build default: %s\n",
+           corpus.size(), iterations, defaultImageDecoder()->name);
+    printHeader();
+    fflush(stdout);
+
+    int status = 0;
+    for (const ImageDecoder *decoder : decoders) {
+        for (int numThreads : threadCounts) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                // warm up once so lazy init inside the backend isn't timed
+                Image image;
+                if (decoder->decode(corpus[0].data, corpus[0].size, &image))
+                    decoder->release(&image);
+
+                BenchResult result = runBench(decoder, corpus, numThreads, iterations);
+                printResult(decoder, numThreads, result, peakRssKb());
+                _exit(result.failed > 0 ? 1 : 0);
+            }
+
+            int childStatus = 0;
+            waitpid(pid, &childStatus, 0);
+            if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0)
+                status = 1;
+        }
+    }
+
+    return status;
+}